@@ -48,7 +48,7 @@ args = parser.parse_args()
 new_dir(args.tmpdir)
 TMP_IMG_FILE = "{}/tmp-img%09d.{}".format(args.tmpdir,args.filetype)
 
-data = list(read_pp_data(open_file(args.input)))
+data = list(read_snapshots(args.input))
 
 style_data = {}
 if args.style is not None:
@@ -6,19 +6,19 @@ def parameter_combinations(d):
     """ Generate different parameter combinations.
         Parameter 'd' is a dictionary consisting of (key,list) pairs. The list contains
         all the different values for 'key'. """
-    # expand into (key, value) list
-    kvls = [[(k, l) for l in d[k]] for k in d.keys()] 
+    # expand into (key, value) list; the keys in alphabetical order, as the simulator's
+    # in-process sweep (simulator/cases.h) numbers the cases in the same order
+    kvls = [[(k, l) for l in d[k]] for k in sorted(d.keys())]
 
     for vals in itertools.product(*kvls):
         p = dict()
         for (key,value) in vals:
             p[key] = value
         yield p
-    raise StopIteration()
 
 def generate_cases(specification):
-    combinations = specification["combine"]
-    alternatives = specification["alternate"]
+    combinations = specification.get("combine", {})
+    alternatives = specification.get("alternate", [{}])
     for pc in parameter_combinations(combinations):
         for d in alternatives:
             p = copy.deepcopy(pc)
@@ -1,6 +1,50 @@
 import collections
+import struct
 from util import *
 
+BINARY_SNAPSHOT_MAGIC = b'PPSNAP1\x00'
+
+def is_binary_snapshot_file(fname):
+    with open(fname, 'rb') as f:
+        return f.read(8) == BINARY_SNAPSHOT_MAGIC
+
+def read_binary_snapshots(fname):
+    """ Read a binary snapshot file (ppsim/binary_snapshot.h) without copying the coordinates.
+        Yields the same entries as read_pp_data, but xs and ys map entities to numpy arrays
+        that are views into the memory-mapped file. """
+    import numpy as np
+    Entry = collections.namedtuple('Entry', ['time', 'events', 'xs', 'ys'])
+    data = np.memmap(fname, dtype=np.uint8, mode='r')
+    magic, version, coord_bytes, entities, _, U, frames, index_offset = struct.unpack_from('<8sIIIIdQQ', data, 0)
+    if magic != BINARY_SNAPSHOT_MAGIC:
+        raise ValueError("'{}' is not a binary snapshot file".format(fname))
+    # the footer is always valid, the header only if the file could be patched
+    index_offset, frames, index_magic = struct.unpack_from('<QQ8s', data, len(data) - 24)
+    if index_magic != b'PPSNAPIX':
+        raise ValueError("'{}' is not a finished binary snapshot file".format(fname))
+    dtype = np.dtype('<f4') if coord_bytes == 4 else np.dtype('<f8')
+    offsets = np.frombuffer(data, dtype='<u8', count=frames, offset=index_offset)
+    for offset in offsets:
+        offset = int(offset)
+        time, events = struct.unpack_from('<dQ', data, offset)
+        counts = np.frombuffer(data, dtype='<u8', count=entities, offset=offset + 16)
+        position = offset + 16 + 8*entities
+        pxs = {}
+        pys = {}
+        for e, n in enumerate(counts):
+            n = int(n)
+            if n > 0:
+                pxs[e] = np.frombuffer(data, dtype=dtype, count=n, offset=position)
+                pys[e] = np.frombuffer(data, dtype=dtype, count=n, offset=position + n*dtype.itemsize)
+            position += 2*n*dtype.itemsize
+        yield Entry(time, events, pxs, pys)
+
+def read_snapshots(fname):
+    """ Read a snapshot file in either the text or the binary format """
+    if is_binary_snapshot_file(fname):
+        return read_binary_snapshots(fname)
+    return read_pp_data(open_file(fname))
+
 def read_pp_data(fp):
     Entry = collections.namedtuple('Entry', ['time', 'events', 'xs', 'ys'])
     for line in fp:
@@ -0,0 +1,57 @@
+/*
+ * Cases of a parameter sweep, numbered as generate-cases numbers them (see combinations.py):
+ * every combination of the "combine" lists, with the keys in alphabetical order and the last
+ * one varying fastest, each with every "alternate" set of parameters on top. The case number
+ * selects the RNG stream of a replicate, so both tools must agree on it; the tests compare them.
+ */
+#ifndef __CASES_H_
+#define __CASES_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "json.hpp"
+
+/* Expand a cases specification into the parameter sets of the cases; json objects iterate their keys in alphabetical order */
+inline std::vector<nlohmann::json> expand_cases(const nlohmann::json &spec) {
+    std::vector<nlohmann::json> combinations(1, nlohmann::json::object());
+    if (spec.count("combine")) {
+        for(auto it = spec["combine"].begin(); it != spec["combine"].end(); ++it) {
+            std::vector<nlohmann::json> expanded;
+            for(auto &c : combinations) {
+                for(auto &v : it.value()) {
+                    auto e = c;
+                    e[it.key()] = v;
+                    expanded.push_back(e);
+                }
+            }
+            combinations.swap(expanded);
+        }
+    }
+
+    nlohmann::json alternatives = spec.count("alternate") ? spec["alternate"] : nlohmann::json::array({ nlohmann::json::object() });
+    std::vector<nlohmann::json> cases;
+    for(auto &c : combinations) {
+        for(auto &a : alternatives) {
+            auto p = c;
+            for(auto it = a.begin(); it != a.end(); ++it) {
+                p[it.key()] = it.value();
+            }
+            cases.push_back(p);
+        }
+    }
+    return cases;
+}
+
+/* Model input of one case, as generate-cases writes it to model.json */
+inline nlohmann::json case_input(const nlohmann::json &model_input, const nlohmann::json &parameters, uint32_t id) {
+    auto input = model_input;
+    for(auto it = parameters.begin(); it != parameters.end(); ++it) {
+        input["parameters"][it.key()] = it.value();
+    }
+    input["case"] = parameters;
+    input["id"] = id;
+    return input;
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Exports results files (toxin --results) to CSV, e.g. for the R scripts:
+ *
+ *   ./export-results list results.ppr ...
+ *   ./export-results summaries 1/results.ppr 2/results.ppr -o summaries.csv
+ *   ./export-results density 1/results.ppr -o density.csv
+ *
+ * 'summaries' gives the same columns as gather-summaries; 'density' gives one row per density
+ * output time with the case and replicate in front.
+ */
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <set>
+#include <limits>
+#include <algorithm>
+
+/* cxxopts library */
+#include "cxxopts.hpp"
+
+/* JSON library */
+#include "json.hpp"
+using json = nlohmann::json;
+
+/* Simulator headers */
+#include "ppsim/pp.h"
+
+using namespace pp;
+
+cxxopts::Options parse_args(int argc, char *argv[]) {
+    try {
+        cxxopts::Options options("export-results", "Export results files to CSV");
+        options.positional_help("list|summaries|density results...");
+        options.add_options()
+          ("h,help", "Print help")
+          ("o,output", "CSV output file (default: standard output)", cxxopts::value<std::string>())
+          ("positional", "Command and results files", cxxopts::value<std::vector<std::string>>())
+          ;
+        options.parse_positional(std::vector<std::string>{"positional"});
+        options.parse(argc, argv);
+
+        if (options.count("help") || options.count("positional") < 2) {
+            std::cout << options.help({""}) << std::endl;
+            exit(options.count("help") ? 0 : 1);
+        }
+        return options;
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "error parsing options: " << e.what() << std::endl;
+        exit(1);
+    }
+}
+
+/* Call f(chunk header, payload) for every chunk of the given kind */
+template<typename F>
+void for_each_chunk(const std::vector<std::string> &files, uint32_t kind, F f) {
+    for(auto &fname : files) {
+        ResultsReader reader(fname);
+        if (reader.is_truncated()) {
+            std::cerr << "'" << fname << "' has an incomplete chunk, which is skipped" << std::endl;
+        }
+        for(auto &c : reader.chunks()) {
+            if (c.header.kind == kind) {
+                f(c.header, reader.read(c));
+            }
+        }
+    }
+}
+
+void list(const std::vector<std::string> &files, std::ostream &out) {
+    out << "file,kind,case,replicate,bytes,raw.bytes" << '\n';
+    for(auto &fname : files) {
+        ResultsReader reader(fname);
+        for(auto &c : reader.chunks()) {
+            out << fname << "," << results_kind_name(c.header.kind) << "," << c.header.case_id << ","
+                << c.header.replicate << "," << c.header.size << "," << c.header.raw_size << '\n';
+        }
+    }
+}
+
+std::string csv_value(const json &v) {
+    if (v.is_null()) return "NA";
+    if (v.is_string()) return v.get<std::string>();
+    return v.dump();
+}
+
+void summaries(const std::vector<std::string> &files, std::ostream &out) {
+    /* fields that gather does not output */
+    const std::set<std::string> skipped = { "events", "seed", "case", "replicate" };
+    std::vector<std::map<std::string, std::string>> rows;
+    std::set<std::string> columns;
+    for_each_chunk(files, RESULTS_SUMMARY, [&](const ResultsChunkHeader &h, const std::string &payload) {
+        std::stringstream lines(payload);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.empty()) continue;
+            auto s = json::parse(line);
+            std::map<std::string, std::string> row;
+            for(auto it = s.begin(); it != s.end(); ++it) {
+                if (!skipped.count(it.key())) row[it.key()] = csv_value(it.value());
+            }
+            row["replicate.seed"] = std::to_string(h.replicate);
+            if (!row.count("case.id")) row["case.id"] = std::to_string(h.case_id);
+            for(auto &c : row) columns.insert(c.first);
+            rows.push_back(row);
+        }
+    });
+
+    out << join(",", columns) << '\n';
+    for(auto &row : rows) {
+        bool first = true;
+        for(auto &c : columns) {
+            auto it = row.find(c);
+            out << (first ? "" : ",") << (it == row.end() ? "NA" : it->second);
+            first = false;
+        }
+        out << '\n';
+    }
+}
+
+void density(const std::vector<std::string> &files, std::ostream &out) {
+    bool header_written = false;
+    for_each_chunk(files, RESULTS_DENSITY, [&](const ResultsChunkHeader &h, const std::string &payload) {
+        std::stringstream lines(payload);
+        std::string line;
+        bool header = true;
+        while (std::getline(lines, line)) {
+            std::replace(line.begin(), line.end(), '\t', ',');
+            if (header) {
+                if (!header_written) out << "case.id,replicate," << line << '\n';
+                header_written = true;
+                header = false;
+                continue;
+            }
+            out << h.case_id << "," << h.replicate << "," << line << '\n';
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        auto options = parse_args(argc, argv);
+        auto args = options["positional"].as<std::vector<std::string>>();
+        auto command = args[0];
+        std::vector<std::string> files(args.begin()+1, args.end());
+
+        std::shared_ptr<std::ostream> out(&std::cout, [](std::ostream*) {});
+        if (options.count("output")) {
+            out = open_output_stream(options["output"].as<std::string>());
+        }
+
+        if (command == "list") {
+            list(files, *out);
+        } else if (command == "summaries") {
+            summaries(files, *out);
+        } else if (command == "density") {
+            density(files, *out);
+        } else {
+            throw std::runtime_error("Unknown command '" + command + "'");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Exception encountered: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -10,7 +10,15 @@
 #include <string>
 #include <chrono>
 #include <iomanip>
+#include <sstream>
+#include <algorithm>
 #include <cstdint>
+#include <mutex>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
 
 /* cxxopts library */
 #include "cxxopts.hpp"
@@ -27,9 +35,11 @@ using namespace pp;
 /* Include the model */
 #include MODEL
 
-/* Logging macro */
+/* Logging macro; the lock keeps lines of the sweep threads apart */
 auto start_time = std::chrono::system_clock::now();
+std::recursive_mutex log_mutex;
 #define LOG(str) do { \
+    std::lock_guard<std::recursive_mutex> log_lock(log_mutex); \
     auto current = std::chrono::system_clock::now(); \
     auto elapsed = std::chrono::duration<double>(current-start_time); \
     std::cout << std::fixed << std::setprecision(10) << elapsed.count() << " -- "; \
@@ -52,6 +62,36 @@ cxxopts::Options parse_args(int argc, char *argv[]) {
           ("o,output", "Snapshot output file", cxxopts::value<std::string>())
           ("d,density", "Density file", cxxopts::value<std::string>())
           ("s,seed", "RNG seed", cxxopts::value<seed_t>())
+          ("case", "Case number; with --replicate, selects an independent RNG stream of the seed", cxxopts::value<uint32_t>())
+          ("replicate", "Replicate number within the case", cxxopts::value<uint32_t>())
+          ("output-format", "Snapshot output format: text, binary (float32 coordinates) or binary64", cxxopts::value<std::string>()->default_value("text"))
+          ("e,event-log", "Event log output file: records every event, see ./replay", cxxopts::value<std::string>())
+          ("keyframe-every", "Time between full keyframes in the event log", cxxopts::value<double>()->default_value("10.0"))
+          ("summary", "Write a JSON line summarising the outcome of the run (first passage times, final counts)", cxxopts::value<std::string>())
+          ("summary-entities", "Comma separated entities for the summary", cxxopts::value<std::string>()->default_value("BACTERIA,TISSUE"))
+          ("results", "Append the density series and summary of this replicate to a shared results file", cxxopts::value<std::string>())
+          ("results-summary-only", "Only append the summary to the results file", cxxopts::value<bool>())
+          ("async-output", "Format and write output files on a background thread", cxxopts::value<bool>())
+          ("cases", "Run the parameter sweep of a cases file (as used by generate-cases) in this process", cxxopts::value<std::string>())
+          ("R,replicates", "Replicates of each case in a sweep", cxxopts::value<uint32_t>()->default_value("1"))
+          ("threads", "Threads for a sweep (default: one per hardware thread)", cxxopts::value<unsigned int>()->default_value("0"))
+          ("ci-width", "Sequential stopping: run the replicates of each case in batches until the confidence interval of the infection probability is narrower than this, with -R as the maximum", cxxopts::value<double>())
+          ("confidence", "Confidence level of the interval for --ci-width", cxxopts::value<double>()->default_value("0.95"))
+          ("batch", "Replicates per batch for --ci-width", cxxopts::value<uint32_t>()->default_value("10"))
+          ("outcome-entity", "Entity whose survival counts as infection for --ci-width", cxxopts::value<std::string>()->default_value("BACTERIA"))
+          ("id50", "ID50 search: estimate the 50% infective dose of this parameter for each combination of the other parameters in --cases, with -R as the maximum number of replicates", cxxopts::value<std::string>())
+          ("dose-range", "Dose range LOW,HIGH of the ID50 search (default: the values of the parameter in the cases file)", cxxopts::value<std::string>())
+          ("id50-ci-width", "Width in log10 dose of the confidence interval at which the ID50 search stops", cxxopts::value<double>()->default_value("0.2"))
+          ("id50-output", "ID50 estimates, one JSON line per combination", cxxopts::value<std::string>())
+          ("split-levels", "Multilevel splitting: estimate the infection probability of each case in --cases by splitting the trajectories at these increasing counts L1,L2,... of --split-entity, with -R trajectories per stage", cxxopts::value<std::string>())
+          ("split-entity", "Entity whose count is the progress coordinate of --split-levels (default: --outcome-entity)", cxxopts::value<std::string>())
+          ("split-repeats", "Independent splitting estimates of each case, for the standard error", cxxopts::value<uint32_t>()->default_value("10"))
+          ("split-output", "Splitting estimates, one JSON line per case", cxxopts::value<std::string>())
+          ("shared-setup", "Set up the initial state of each case of a sweep once and copy it into the replicates, which then differ only by their RNG streams", cxxopts::value<bool>())
+          ("checkpoint", "Write checkpoints of the run to this file, every --checkpoint-every time units and on SIGUSR1; on SIGTERM write one and stop", cxxopts::value<std::string>())
+          ("checkpoint-every", "Simulated time between checkpoints (0: only on signals)", cxxopts::value<double>()->default_value("0"))
+          ("restore", "Continue the run of a checkpoint; give the same model, time and output options as the checkpointed run", cxxopts::value<std::string>())
+          ("runtimes", "Run times of earlier sweeps for scheduling the longest replicates first; extended with this sweep", cxxopts::value<std::string>())
           ("p,propensity", "Print propensity of initial configuration", cxxopts::value<bool>())
           ("positional", "Positional arguments: these are the arguments that are entered without an option", cxxopts::value<std::vector<std::string>>())
           ;
@@ -74,7 +114,8 @@ cxxopts::Options parse_args(int argc, char *argv[]) {
         exit(1);
     }
 }
-int read_input_points(Simulator &s, std::ifstream in) { 
+template<typename S>
+int read_input_points(S &s, std::ifstream in) { 
     int n = 0;
     std::array<coord_t,SimulationState::DIM> coords;
     uint_t entity;
@@ -95,18 +136,30 @@ int read_input_points(Simulator &s, std::ifstream in) {
 }
 
 #include <csignal> 
+#include <atomic>
 
 
+/* The handler only sets the flag; the run and sweep loops log it (log_interrupt) when they stop */
 volatile sig_atomic_t SIG_INT_RECEIVED = 0;
 void interrupt_handler(int) {
     SIG_INT_RECEIVED += 1;
-    LOG("SIGINT received. Waiting for current step to finish...");
 }
 
-bool interrupt_received(const SimulationState &) {
-    return SIG_INT_RECEIVED;
+/* Log a received SIGINT once, from whichever loop notices it first */
+void log_interrupt() {
+    static std::atomic<bool> logged(false);
+    if (SIG_INT_RECEIVED && !logged.exchange(true)) {
+        LOG("SIGINT received. Stopping.");
+    }
+}
+
+/* SIGUSR1 or SIGTERM: write a checkpoint after the current step (and stop on SIGTERM) */
+volatile sig_atomic_t CHECKPOINT_REQUESTED = 0;
+void checkpoint_handler(int signal) {
+    CHECKPOINT_REQUESTED = signal;
 }
 
+
 template<typename T>
 T get_parameter(std::string name, json &defaults, cxxopts::Options &options) {
     bool opt_has = options.count(name);
@@ -131,8 +184,9 @@ bool is_set(std::string name, json &defaults, cxxopts::Options &options) {
     return opt_has || def_has;
 }
 
-std::shared_ptr<std::fstream> open_output(std::string fname) {
-    auto f = std::make_shared<std::fstream>(fname, std::ios::out);
+/* Open an output file; names ending with .gz are compressed while writing */
+std::shared_ptr<std::ostream> open_output(std::string fname) {
+    auto f = open_output_stream(fname);
     if (f->fail()) {
         LOG("Could not open file '" << fname << "': " << strerror(errno));
         exit(1);
@@ -140,6 +194,129 @@ std::shared_ptr<std::fstream> open_output(std::string fname) {
     return f;
 }
 
+/* Summary writer with the given entities and the case parameters as fields */
+template<typename S>
+SummaryWriter &make_summary_writer(S &s, std::shared_ptr<std::ostream> out, const json &json_model_input, const std::string &entities) {
+    std::vector<std::pair<uint_t, std::string>> watched;
+    std::stringstream names(entities);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        if (!json_model_input["entities"].count(name)) {
+            throw std::runtime_error("Unknown summary entity '" + name + "'");
+        }
+        uint_t entity = json_model_input["entities"][name];
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower); // column names as in gather
+        watched.push_back(std::make_pair(entity, name));
+    }
+    auto &w = s.template make_writer<SummaryWriter>(out,watched);
+    if (json_model_input.count("id")) {
+        w.add_field("case.id", json_model_input["id"].dump());
+    }
+    if (json_model_input.count("case")) {
+        auto c = json_model_input["case"];
+        for(auto it = c.begin(); it != c.end(); ++it) {
+            w.add_field(it.key(), it.value().dump());
+        }
+    }
+    return w;
+}
+
+/* Summary writer of a single run, with the seed and stream from the command line */
+template<typename S>
+void make_summary_writer(S &s, std::shared_ptr<std::ostream> out, json &json_model_input, json &defaults, cxxopts::Options &options) {
+    auto &w = make_summary_writer(s, out, json_model_input, options["summary-entities"].as<std::string>());
+    if (is_set("seed", defaults, options)) {
+        w.add_field("seed", std::to_string(get_parameter<seed_t>("seed", defaults, options)));
+    }
+    if (options.count("case")) {
+        w.add_field("case", std::to_string(options["case"].as<uint32_t>()));
+    }
+    if (options.count("replicate")) {
+        w.add_field("replicate", std::to_string(options["replicate"].as<uint32_t>()));
+    }
+}
+
+/*
+ * Output files of a checkpointed run. Their sizes are recorded in each checkpoint, and a
+ * restored run cuts off what was written after the checkpoint before appending, so that the
+ * files end up as those of an uninterrupted run. Only plain files can be cut like this.
+ */
+class CheckpointedOutputs {
+public:
+    std::shared_ptr<std::ostream> open(const std::string &fname) {
+        if (has_gzip_extension(fname)) {
+            throw std::runtime_error("Compressed output '" + fname + "' cannot be used with checkpoints");
+        }
+        std::shared_ptr<std::ostream> out;
+        if (restoring) {
+            if (!sizes.count(fname)) {
+                throw std::runtime_error("Output '" + fname + "' is not an output of the checkpointed run");
+            }
+            if (truncate(fname.c_str(), sizes[fname]) != 0) {
+                throw std::runtime_error("Could not cut output '" + fname + "' to its size at the checkpoint: " + strerror(errno));
+            }
+            out = std::make_shared<std::ofstream>(fname, std::ios::out | std::ios::app | std::ios::binary);
+            if (out->fail()) {
+                throw std::runtime_error("Could not open output '" + fname + "' for appending");
+            }
+        } else {
+            out = open_output(fname);
+        }
+        outputs.push_back(std::make_pair(fname, out));
+        return out;
+    }
+
+    /* Call after the writers are flushed */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value<uint64_t>(outputs.size());
+        for(auto &o : outputs) {
+            w.string(o.first);
+            w.value<uint64_t>(o.second->tellp());
+        }
+    }
+
+    /* Output sizes of a checkpoint; call before opening the outputs */
+    void read_checkpoint(CheckpointReader &r) {
+        auto n = r.value<uint64_t>();
+        for(auto i = 0u; i<n; i++) {
+            auto name = r.string();
+            sizes[name] = r.value<uint64_t>();
+        }
+        restoring = true;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::shared_ptr<std::ostream>>> outputs;
+    std::map<std::string, uint64_t> sizes;
+    bool restoring = false;
+};
+
+/* Write a checkpoint atomically: into a temporary file which then replaces the old checkpoint */
+template<typename S>
+void write_checkpoint(const std::string &fname, S &s, const CheckpointedOutputs &outputs, const json &json_model_input, double time) {
+    s.flush_writers();
+    auto tmp = fname + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::out | std::ios::binary);
+        CheckpointWriter w(f);
+        w.header();
+        w.string(json_model_input.dump());
+        w.value(time);
+        outputs.write_checkpoint(w);
+        s.write_checkpoint(w);
+        f.flush();
+        if (!w.good()) {
+            throw std::runtime_error("Could not write checkpoint '" + tmp + "'");
+        }
+    }
+    if (std::rename(tmp.c_str(), fname.c_str()) != 0) {
+        throw std::runtime_error("Could not replace checkpoint '" + fname + "': " + strerror(errno));
+    }
+    LOG("Checkpoint at time " << s.get_state().stats.time << " written to '" << fname << "'");
+}
+
+#include "sweep.h"
+
 int main(int argc, char *argv[]) {
 #ifdef DEBUG
     LOG("DEBUG flag set");
@@ -172,6 +349,168 @@ int main(int argc, char *argv[]) {
         auto time = get_parameter<double>("time", defaults, options);
         double U = get_parameter<double>("domain", defaults, options);
 
+        /* Parameter sweep: all cases and replicates in this process */
+        if (options.count("cases")) {
+            for(auto o : { "output", "density", "event-log", "step", "checkpoint", "restore" }) {
+                if (options.count(o)) {
+                    throw std::runtime_error(std::string("--") + o + " cannot be used with --cases, use --results or --summary");
+                }
+            }
+            json spec;
+            std::ifstream cases_file(options["cases"].as<std::string>());
+            if (!cases_file) {
+                throw std::runtime_error("Could not open cases file '" + options["cases"].as<std::string>() + "'");
+            }
+            cases_file >> spec;
+
+            SweepSettings settings;
+            settings.time = time;
+            settings.U = U;
+            settings.dt = dt;
+            if (is_set("seed", defaults, options)) {
+                settings.master_seed = get_parameter<seed_t>("seed", defaults, options);
+            } else {
+                std::random_device rd;
+                settings.master_seed = (seed_t(rd()) << 32) | rd(); // logged, so the sweep can be repeated
+            }
+            settings.summary_entities = options["summary-entities"].as<std::string>();
+            if (options.count("results")) {
+                LOG("Appending results to '" << options["results"].as<std::string>() << "'");
+                settings.results = std::make_shared<ResultsFile>(options["results"].as<std::string>());
+                settings.results_summary_only = options.count("results-summary-only");
+            }
+            if (options.count("summary")) {
+                LOG("Output summaries to '" << options["summary"].as<std::string>() << "'");
+                settings.summary = std::make_shared<SharedOutput>(open_output(options["summary"].as<std::string>()));
+            }
+            auto outcome = options["outcome-entity"].as<std::string>();
+            if (!json_model_input["entities"].count(outcome)) {
+                throw std::runtime_error("Unknown outcome entity '" + outcome + "'");
+            }
+            settings.outcome_entity = json_model_input["entities"][outcome];
+            settings.confidence = options["confidence"].as<double>();
+            settings.batch = options["batch"].as<uint32_t>();
+            if (settings.batch == 0) {
+                throw std::runtime_error("--batch must be positive");
+            }
+            if (options.count("ci-width")) {
+                settings.ci_width = options["ci-width"].as<double>();
+            }
+            /* input points are read once into the shared initial states */
+            settings.shared_setup = options.count("shared-setup") || options.count("input");
+            if (options.count("input")) {
+                settings.input_points = options["input"].as<std::string>();
+                LOG("Reading input configuration of each case from '" << settings.input_points << "'");
+            }
+            if (settings.shared_setup) {
+                LOG("Setting up each case once for all its replicates");
+            }
+            if (options.count("runtimes")) {
+                settings.runtimes = options["runtimes"].as<std::string>();
+                LOG("Runtime history in '" << settings.runtimes << "'");
+            }
+
+            std::signal(SIGINT, interrupt_handler); 
+            if (options.count("split-levels")) {
+                for(auto o : { "ci-width", "id50", "results", "summary" }) {
+                    if (options.count(o)) {
+                        throw std::runtime_error(std::string("--") + o + " cannot be used with --split-levels");
+                    }
+                }
+                SplittingSweep split;
+                std::stringstream levels(options["split-levels"].as<std::string>());
+                for(std::string l; std::getline(levels, l, ','); ) {
+                    split.splitting.levels.push_back(std::stod(l));
+                }
+                if (split.splitting.levels.empty()) {
+                    throw std::runtime_error("--split-levels must be given as L1,L2,...");
+                }
+                split.entity_name = options.count("split-entity") ? options["split-entity"].as<std::string>() : outcome;
+                if (!json_model_input["entities"].count(split.entity_name)) {
+                    throw std::runtime_error("Unknown splitting entity '" + split.entity_name + "'");
+                }
+                split.splitting.entity = json_model_input["entities"][split.entity_name];
+                split.splitting.outcome_entity = settings.outcome_entity;
+                split.splitting.time = time;
+                split.splitting.trajectories = options["replicates"].as<uint32_t>();
+                split.repetitions = options["split-repeats"].as<uint32_t>();
+                if (split.repetitions == 0) {
+                    throw std::runtime_error("--split-repeats must be positive");
+                }
+                if (options.count("split-output")) {
+                    LOG("Output splitting estimates to '" << options["split-output"].as<std::string>() << "'");
+                    split.output = std::make_shared<SharedOutput>(open_output(options["split-output"].as<std::string>()));
+                }
+                run_splitting(json_model_input, spec, options["threads"].as<unsigned int>(), settings, split);
+                return 0;
+            }
+            if (options.count("id50")) {
+                if (options.count("ci-width")) {
+                    throw std::runtime_error("--ci-width cannot be used with --id50, use --id50-ci-width");
+                }
+                Id50Settings id50;
+                id50.parameter = options["id50"].as<std::string>();
+                id50.ci_width = options["id50-ci-width"].as<double>();
+                if (options.count("dose-range")) {
+                    std::stringstream range(options["dose-range"].as<std::string>());
+                    char comma;
+                    if (!(range >> id50.low >> comma >> id50.high) || comma != ',') {
+                        throw std::runtime_error("--dose-range must be given as LOW,HIGH");
+                    }
+                } else if (spec.count("combine") && spec["combine"].count(id50.parameter)) {
+                    auto doses = spec["combine"][id50.parameter].get<std::vector<double>>();
+                    id50.low = *std::min_element(doses.begin(), doses.end());
+                    id50.high = *std::max_element(doses.begin(), doses.end());
+                } else {
+                    throw std::runtime_error("No dose range for '" + id50.parameter + "': give --dose-range or its values in the cases file");
+                }
+                if (!(id50.low > 0 && id50.low < id50.high)) {
+                    throw std::runtime_error("The dose range must satisfy 0 < LOW < HIGH");
+                }
+                if (options.count("id50-output")) {
+                    LOG("Output ID50 estimates to '" << options["id50-output"].as<std::string>() << "'");
+                    id50.output = std::make_shared<SharedOutput>(open_output(options["id50-output"].as<std::string>()));
+                }
+                run_id50_search(json_model_input, spec, options["replicates"].as<uint32_t>(), options["threads"].as<unsigned int>(), settings, id50);
+                return 0;
+            }
+            run_sweep(json_model_input, spec, options["replicates"].as<uint32_t>(), options["threads"].as<unsigned int>(), settings);
+            return 0;
+        }
+
+        /* Checkpoints cover the plain text outputs, which can be cut back to their size at a checkpoint */
+        bool checkpointing = options.count("checkpoint") || options.count("restore");
+        if (checkpointing) {
+            for(auto o : { "event-log", "results", "async-output", "step" }) {
+                if (options.count(o)) {
+                    throw std::runtime_error(std::string("--") + o + " cannot be used with --checkpoint or --restore");
+                }
+            }
+            if (options["output-format"].as<std::string>() != "text") {
+                throw std::runtime_error("Binary snapshots cannot be used with --checkpoint or --restore");
+            }
+        }
+        CheckpointedOutputs checkpointed_outputs;
+        std::ifstream restore_file;
+        std::unique_ptr<CheckpointReader> restore;
+        if (options.count("restore")) {
+            auto fname = options["restore"].as<std::string>();
+            LOG("Restoring the run from checkpoint '" << fname << "'");
+            restore_file.open(fname, std::ios::in | std::ios::binary);
+            if (!restore_file) {
+                throw std::runtime_error("Could not open checkpoint '" + fname + "'");
+            }
+            restore = std::unique_ptr<CheckpointReader>(new CheckpointReader(restore_file));
+            restore->header();
+            if (restore->string() != json_model_input.dump() || restore->value<double>() != time) {
+                throw std::runtime_error("The checkpoint is of a run with another model input or time");
+            }
+            checkpointed_outputs.read_checkpoint(*restore);
+        }
+        auto open_run_output = [&](const std::string &fname) {
+            return checkpointing ? checkpointed_outputs.open(fname) : open_output(fname);
+        };
+
         /* Construct the model */
         LOG("Constructing the model");
         auto m = get_model(json_model_input);
@@ -181,13 +520,19 @@ int main(int argc, char *argv[]) {
 
         /* Set up the simulator */
         LOG("Creating the simulator");
-        auto s = Simulator(U,m);
+        BasicSimulator<decltype(m)> s(U, m);
 
         /* Register SIGINT handler for convenience */
         std::signal(SIGINT, interrupt_handler); 
-        s.add_halting_condition(&interrupt_received);
-
-        if (is_set("seed", defaults, options)) {
+        s.add_halting_flag(&SIG_INT_RECEIVED);
+
+        if (options.count("case") || options.count("replicate")) {
+            seed_t seed = is_set("seed", defaults, options) ? get_parameter<seed_t>("seed", defaults, options) : 0;
+            StreamId id(options.count("case") ? options["case"].as<uint32_t>() : 0,
+                        options.count("replicate") ? options["replicate"].as<uint32_t>() : 0);
+            s.set_stream(seed, id);
+            LOG("Using '" << seed << "' as master seed with " << id);
+        } else if (is_set("seed", defaults, options)) {
             auto seed = get_parameter<seed_t>("seed", defaults, options);
             //auto seed = std::stoull(seed_input); // in principle, we could convert input seed string in some other way for more entropy
             s.set_seed(seed);
@@ -198,7 +543,9 @@ int main(int argc, char *argv[]) {
         setup_state(s, json_model_input);
         LOG("Initial state: " << s.get_state());
 
-        if (options.count("input")) {
+        if (restore) {
+            LOG("The initial state is replaced by the checkpoint");
+        } else if (options.count("input")) {
             auto infname = options["input"].as<std::string>();
             LOG("Reading input configuration from '" << infname << "'");
             auto c = read_input_points(s, std::ifstream(infname));
@@ -209,26 +556,78 @@ int main(int argc, char *argv[]) {
 
 
         /* Open the snapshot output file */
+        bool async_output = options.count("async-output");
+        std::vector<std::pair<std::string, const OutputStallStats*>> async_writers;
         if (options.count("output")) {
             auto outfname = options["output"].as<std::string>();
-            LOG("Output snapshots to '" << outfname << "'");
-            s.make_writer<SnapshotWriter>(open_output(outfname),dt);
+            auto format = options["output-format"].as<std::string>();
+            LOG("Output snapshots to '" << outfname << "' in " << format << " format");
+            if (format == "binary" || format == "binary64") {
+                auto binary = BinarySnapshotFormat(format == "binary64");
+                if (async_output) {
+                    auto &w = s.make_writer<AsyncWriter<BinarySnapshotFormat>>(open_output(outfname),dt,2,binary);
+                    async_writers.push_back(std::make_pair(outfname, &w.get_stall_stats()));
+                } else {
+                    s.make_writer<FormatWriter<BinarySnapshotFormat>>(open_output(outfname),dt,binary);
+                }
+            } else if (format != "text") {
+                throw std::runtime_error("Unknown output format '" + format + "'");
+            } else if (async_output) {
+                auto &w = s.make_writer<AsyncWriter<SnapshotFormat>>(open_output(outfname),dt);
+                async_writers.push_back(std::make_pair(outfname, &w.get_stall_stats()));
+            } else {
+                s.make_writer<SnapshotWriter>(open_run_output(outfname),dt);
+            }
         }
 
         /* Open the density output file */
         if (options.count("density")) {
             auto outfname = options["density"].as<std::string>();
             LOG("Output density to '" << outfname << "'");
-            s.make_writer<DensityWriter>(open_output(outfname),dt);
+            if (async_output) {
+                auto &w = s.make_writer<AsyncWriter<DensityFormat>>(open_output(outfname),dt);
+                async_writers.push_back(std::make_pair(outfname, &w.get_stall_stats()));
+            } else {
+                s.make_writer<DensityWriter>(open_run_output(outfname),dt);
+            }
+        }
+
+        /* Open the event log */
+        if (options.count("event-log")) {
+            auto outfname = options["event-log"].as<std::string>();
+            auto keyframe_dt = options["keyframe-every"].as<double>();
+            LOG("Logging events to '" << outfname << "' with keyframes every " << keyframe_dt << " time units");
+            s.make_writer<EventLogWriter>(open_output(outfname),keyframe_dt);
+        }
+
+        /* Outcome summary */
+        if (options.count("summary")) {
+            auto outfname = options["summary"].as<std::string>();
+            LOG("Output summary to '" << outfname << "'");
+            make_summary_writer(s, open_run_output(outfname), json_model_input, defaults, options);
+        }
+
+        /* Results container: the density series and the summary become chunks of a shared file */
+        if (options.count("results")) {
+            auto outfname = options["results"].as<std::string>();
+            uint32_t case_id = options.count("case") ? options["case"].as<uint32_t>() : 
+                               json_model_input.count("id") ? json_model_input["id"].get<uint32_t>() : 0;
+            uint32_t replicate = options.count("replicate") ? options["replicate"].as<uint32_t>() : 0;
+            LOG("Appending results of case " << case_id << ", replicate " << replicate << " to '" << outfname << "'");
+            auto results = std::make_shared<ResultsFile>(outfname);
+            if (!options.count("results-summary-only")) {
+                s.make_writer<DensityWriter>(std::make_shared<ResultsChunkStream>(results, RESULTS_DENSITY, case_id, replicate),dt);
+            }
+            make_summary_writer(s, std::make_shared<ResultsChunkStream>(results, RESULTS_SUMMARY, case_id, replicate), json_model_input, defaults, options);
         }
 
         if (options.count("propensity")) {
             LOG("Propensities:");
             double total = 0;
-            for(const auto &t : s.model.get_trackers()) {
-                auto prop = t->propensity();
+            for(auto i = 0u; i<s.model.process_count(); i++) {
+                auto prop = s.model.propensity(i);
                 total += prop;
-                LOG(t->get_process() << " = " << prop);
+                LOG(s.model.get_process(i) << " = " << prop);
             }
             LOG("====== TOTAL: " << total);
         }
@@ -240,9 +639,38 @@ int main(int argc, char *argv[]) {
                 s.step();
             }
         } else {
-            LOG("Running the simulation for " << time << " time units");
-            s.run(time);
+            bool stopped = false; // at a checkpoint on SIGTERM
+            if (options.count("checkpoint")) {
+                auto fname = options["checkpoint"].as<std::string>();
+                auto every = options["checkpoint-every"].as<double>();
+                LOG("Checkpoints to '" << fname << "'" << (every > 0 ? " every " + std::to_string(every) + " time units" : "") 
+                    << " and on SIGUSR1 or SIGTERM");
+                std::signal(SIGUSR1, checkpoint_handler);
+                std::signal(SIGTERM, checkpoint_handler);
+                s.set_checkpointing([&]() {
+                    stopped = CHECKPOINT_REQUESTED == SIGTERM;
+                    write_checkpoint(fname, s, checkpointed_outputs, json_model_input, time);
+                    return stopped;
+                }, every, &CHECKPOINT_REQUESTED);
+            }
+            if (restore) {
+                s.read_checkpoint(*restore);
+                LOG("Continuing the run from time " << s.get_state().stats.time);
+                s.resume();
+            } else {
+                LOG("Running the simulation for " << time << " time units");
+                s.run(time);
+            }
+            log_interrupt();
             LOG("Simulation stopped at time " << s.get_state().stats.time << ". Halting reason: " << s.get_halt_reason());
+            if (stopped) {
+                LOG("Continue the run with --restore " << options["checkpoint"].as<std::string>());
+                return 128 + SIGTERM;
+            }
+            for(auto &w : async_writers) {
+                LOG("Output to '" << w.first << "' stalled the simulation " << w.second->stalls << " times out of " 
+                    << w.second->snapshots << " snapshots, " << w.second->stall_seconds << " s in total");
+            }
         }
      } catch (const std::exception& e) {
         LOG("Exception encountered: " << e.what());
@@ -19,7 +19,19 @@ class Accumulator {
                                                   max_value(int(ceil(c/pow(2,d)))*pow(2,d)),
                                                   nodes(std::vector<W>(pow(2,d+1)-1,0))
     { }
-    
+
+    /* Accumulator with exactly one leaf per code, i.e. range_length == 1 */
+    explicit Accumulator(unsigned int c) : Accumulator(c, exact_depth(c)) { }
+
+    /* Smallest depth for which each code gets a leaf of its own */
+    static unsigned int exact_depth(unsigned int c) {
+        unsigned int d = 0;
+        while ((1u << d) < c) d++;
+        return d;
+    }
+
+    inline W total() const { return nodes[0]; }
+
     void increment(unsigned int c, W weight) {
         unsigned int index = 0; // start from root
         unsigned int min = 0;
@@ -43,6 +55,9 @@ class Accumulator {
      * Return the a pair (c,w), where 
      *  - c gives the smallest code found and  
      *  - w gives how much weight needs to be skipped starting from c to reagh the target 'weight_to_skip'.
+     *
+     * With one leaf per code and unit weights, find_start_location(n+1) gives the code
+     * holding the nth (0-based) item and w-1 is the index of that item within the code.
      */
     std::pair<unsigned int, W> find_start_location(W weight_to_skip) const {
         uint_t index = 0; // start from root
@@ -0,0 +1,224 @@
+#ifndef __ASYNC_WRITER_H_
+#define __ASYNC_WRITER_H_
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "common.h"
+#include "simulation_state.h"
+#include "writers.h"
+
+namespace pp {
+
+/*
+ * Compact copy of the simulation state at one output time. The buffers are reused between
+ * snapshots, so after the first few outputs capturing does not allocate.
+ */
+struct StateSnapshot {
+    enum Kind { START, WRITE, END };
+
+    struct PointRecord {
+        coord_t x, y;
+        uint_t entity;
+        inline uint_t get_entity() const { return entity; }
+        inline coord_t operator[](int i) const { return i == 0 ? x : y; }
+    };
+
+    void capture(SimulationState &s, double t, Kind k, bool with_points) {
+        kind = k;
+        time = t;
+        U = s.U();
+        events = s.stats.total_events;
+        counts.resize(s.get_max_entities()+1);
+        for(auto i = 0u; i<counts.size(); i++) {
+            counts[i] = s.get_count(i);
+        }
+        points.clear();
+        if (with_points) {
+            for(auto p : s.enumerate()) {
+                points.push_back(PointRecord { (*p)[0], (*p)[1], p->get_entity() });
+            }
+        }
+    }
+
+    Kind kind;
+    double time;
+    coord_t U;
+    uint_t events;
+    std::vector<uint_t> counts; // points of each entity
+    std::vector<PointRecord> points; // only filled for formats that need the points
+};
+
+/* Same output as SnapshotWriter */
+struct SnapshotFormat {
+    static constexpr bool needs_points = true;
+
+    void operator()(std::ostream &out, const StateSnapshot &s) {
+        out << s.time << " " << s.events << " ";
+        write_points(out, s.points, [](const StateSnapshot::PointRecord &p) { return &p; });
+        out << '\n';
+    }
+};
+
+/* Same output as DensityWriter */
+struct DensityFormat {
+    static constexpr bool needs_points = false;
+
+    void operator()(std::ostream &out, const StateSnapshot &s) {
+        if (s.kind == StateSnapshot::START) {
+            out << "time\tevents";
+            for(auto i = 0u; i<s.counts.size(); i++) {
+                out << "\t" << i;
+            }
+            out << '\n';
+        }
+        out << s.time << "\t" << s.events;
+        for(auto c : s.counts) {
+            out << "\t" << c;
+        }
+        out << '\n';
+    }
+};
+
+/* Writer that formats snapshots with F on the simulation thread */
+template<typename F>
+class FormatWriter : public Writer {
+public:
+    FormatWriter(std::shared_ptr<std::ostream> o, double d, F f = F()) : Writer(d), out(o), format(f) {}
+
+    void write(SimulationState &s, double t) { submit(s, t, StateSnapshot::WRITE); }
+    void start(SimulationState &s) { submit(s, s.stats.time, StateSnapshot::START); }
+    void end(SimulationState &s) { 
+        submit(s, s.stats.time, StateSnapshot::END); 
+        out->flush();
+    }
+
+private:
+    void submit(SimulationState &s, double t, StateSnapshot::Kind kind) {
+        snapshot.capture(s, t, kind, F::needs_points);
+        format(*out, snapshot);
+    }
+
+    std::shared_ptr<std::ostream> out;
+    F format;
+    StateSnapshot snapshot; // reused between writes
+};
+
+/* Time the simulation thread spent waiting for the output thread */
+struct OutputStallStats {
+    uint_t snapshots = 0; // snapshots handed over
+    uint_t stalls = 0; // snapshots that had to wait for a free buffer
+    double stall_seconds = 0; // total waiting time
+};
+
+/*
+ * Writer that formats and writes on a background thread.
+ *
+ * The simulation thread only copies a StateSnapshot into a free buffer and queues it; the
+ * output thread formats the queued snapshots with F (SnapshotFormat or DensityFormat) and
+ * writes them to the stream, including any compression the stream does. There are 'buffers'
+ * snapshot buffers (2 = double buffering): when all of them are queued, the simulation waits
+ * for the output thread (backpressure) and the waiting time is recorded in get_stall_stats().
+ */
+template<typename F>
+class AsyncWriter : public Writer {
+public:
+    AsyncWriter(std::shared_ptr<std::ostream> o, double d, uint_t buffers = 2, F f = F()) : Writer(d), out(o), format(f), closed(false) {
+        for(auto i = 0u; i<std::max<uint_t>(buffers, 1); i++) {
+            free_buffers.push_back(std::unique_ptr<StateSnapshot>(new StateSnapshot()));
+        }
+        worker = std::thread(&AsyncWriter::run, this);
+    }
+
+    ~AsyncWriter() {
+        close();
+    }
+
+    void write(SimulationState &s, double t) { submit(s, t, StateSnapshot::WRITE); }
+    void start(SimulationState &s) { submit(s, s.stats.time, StateSnapshot::START); }
+
+    /* The final snapshot is written and the output flushed before end() returns */
+    void end(SimulationState &s) {
+        submit(s, s.stats.time, StateSnapshot::END);
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return queue.empty() && !busy; });
+        out->flush();
+    }
+
+    /* Write out everything queued and stop the output thread */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) return;
+            closed = true;
+        }
+        changed.notify_all();
+        worker.join();
+        out->flush();
+    }
+
+    const OutputStallStats &get_stall_stats() const { return stats; }
+
+private:
+    void submit(SimulationState &s, double t, StateSnapshot::Kind kind) {
+        std::unique_ptr<StateSnapshot> buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (free_buffers.empty()) {
+                auto wait_start = std::chrono::steady_clock::now();
+                changed.wait(lock, [this]() { return !free_buffers.empty(); });
+                stats.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+                stats.stalls++;
+            }
+            buffer = std::move(free_buffers.back());
+            free_buffers.pop_back();
+        }
+        buffer->capture(s, t, kind, F::needs_points);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(buffer));
+            stats.snapshots++;
+        }
+        changed.notify_all();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this]() { return !queue.empty() || closed; });
+            if (queue.empty()) break; // closed and drained
+            auto buffer = std::move(queue.front());
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+
+            format(*out, *buffer);
+
+            lock.lock();
+            busy = false;
+            free_buffers.push_back(std::move(buffer));
+            changed.notify_all();
+        }
+    }
+
+    std::shared_ptr<std::ostream> out;
+    F format; // only used by the output thread
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable changed; // signalled whenever the queue or the free list changes
+    std::deque<std::unique_ptr<StateSnapshot>> queue; // snapshots waiting to be written
+    std::vector<std::unique_ptr<StateSnapshot>> free_buffers;
+    bool closed;
+    bool busy = false; // output thread is formatting a snapshot
+    OutputStallStats stats;
+};
+
+} // namespace
+
+#endif
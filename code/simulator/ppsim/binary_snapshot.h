@@ -0,0 +1,267 @@
+#ifndef __BINARY_SNAPSHOT_H_
+#define __BINARY_SNAPSHOT_H_
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "async_writer.h"
+
+namespace pp {
+
+/*
+ * Binary columnar snapshot files (little-endian, all sections 8-byte aligned).
+ *
+ *   header   BinarySnapshotHeader (64 bytes)
+ *   frames   for each frame: double time, uint64 events, uint64 counts[entities],
+ *            then for each entity e: coord xs[counts[e]], coord ys[counts[e]],
+ *            padded with zeros to a multiple of 8 bytes
+ *   index    uint64 offsets[frames] (file offset of each frame)
+ *   footer   BinarySnapshotFooter (24 bytes)
+ *
+ * coord is float32 or float64 (header.coord_bytes). The header is patched with the frame
+ * count and index offset when the file is finished; the footer holds the same values so that
+ * files written to non-seekable streams can still be read from the end.
+ * The Python reader is read_binary_snapshots in read.py.
+ */
+struct BinarySnapshotHeader {
+    char magic[8]; // "PPSNAP1"
+    uint32_t version;
+    uint32_t coord_bytes; // 4 or 8
+    uint32_t entities; // entity ids are 0 .. entities-1
+    uint32_t reserved;
+    double U;
+    uint64_t frames; // 0 until the file is finished
+    uint64_t index_offset; // 0 until the file is finished
+    uint64_t padding[2];
+};
+
+struct BinarySnapshotFooter {
+    uint64_t index_offset;
+    uint64_t frames;
+    char magic[8]; // "PPSNAPIX"
+};
+
+static_assert(sizeof(BinarySnapshotHeader) == 64, "Unexpected binary snapshot header size");
+static_assert(sizeof(BinarySnapshotFooter) == 24, "Unexpected binary snapshot footer size");
+
+static constexpr char BINARY_SNAPSHOT_MAGIC[8] = "PPSNAP1";
+static constexpr char BINARY_SNAPSHOT_INDEX_MAGIC[8] = { 'P', 'P', 'S', 'N', 'A', 'P', 'I', 'X' };
+
+/* Snapshot format for FormatWriter/AsyncWriter writing the binary layout above */
+class BinarySnapshotFormat {
+public:
+    static constexpr bool needs_points = true;
+
+    explicit BinarySnapshotFormat(bool double_precision = false) : coord_bytes(double_precision ? 8 : 4) {}
+
+    void operator()(std::ostream &out, const StateSnapshot &s) {
+        if (s.kind == StateSnapshot::START) {
+            write_header(out, s);
+        }
+        if (coord_bytes == 8) {
+            write_frame<double>(out, s);
+        } else {
+            write_frame<float>(out, s);
+        }
+        if (s.kind == StateSnapshot::END) {
+            write_index(out);
+        }
+    }
+
+private:
+    void write_header(std::ostream &out, const StateSnapshot &s) {
+        BinarySnapshotHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, BINARY_SNAPSHOT_MAGIC, sizeof(h.magic));
+        h.version = 1;
+        h.coord_bytes = coord_bytes;
+        h.entities = s.counts.size();
+        h.U = s.U;
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        position = sizeof(h);
+        offsets.clear();
+    }
+
+    template<typename T>
+    void write_frame(std::ostream &out, const StateSnapshot &s) {
+        offsets.push_back(position);
+
+        /* group the coordinates by entity (counting sort) */
+        auto entities = s.counts.size();
+        starts.assign(entities+1, 0);
+        for(const auto &p : s.points) starts[p.entity+1]++;
+        for(auto e = 0u; e<entities; e++) starts[e+1] += starts[e];
+        auto n = s.points.size();
+        std::vector<T> &xs = coords<T>(), &ys = other_coords<T>();
+        xs.resize(n);
+        ys.resize(n);
+        fill = starts;
+        for(const auto &p : s.points) {
+            auto i = fill[p.entity]++;
+            xs[i] = static_cast<T>(p.x);
+            ys[i] = static_cast<T>(p.y);
+        }
+
+        uint64_t events = s.events;
+        put(out, &s.time, 1);
+        put(out, &events, 1);
+        counts.assign(entities, 0);
+        for(auto e = 0u; e<entities; e++) counts[e] = starts[e+1] - starts[e];
+        put(out, counts.data(), entities);
+        for(auto e = 0u; e<entities; e++) {
+            put(out, xs.data() + starts[e], counts[e]);
+            put(out, ys.data() + starts[e], counts[e]);
+        }
+        pad(out);
+    }
+
+    void write_index(std::ostream &out) {
+        BinarySnapshotFooter f;
+        f.index_offset = position;
+        f.frames = offsets.size();
+        std::memcpy(f.magic, BINARY_SNAPSHOT_INDEX_MAGIC, sizeof(f.magic));
+        put(out, offsets.data(), offsets.size());
+        out.write(reinterpret_cast<const char*>(&f), sizeof(f));
+
+        /* patch the header if the stream can seek */
+        auto end = out.tellp();
+        if (end != std::streampos(-1)) {
+            out.seekp(offsetof(BinarySnapshotHeader, frames));
+            out.write(reinterpret_cast<const char*>(&f.frames), sizeof(uint64_t));
+            out.write(reinterpret_cast<const char*>(&f.index_offset), sizeof(uint64_t));
+            out.seekp(end);
+        }
+        out.clear();
+    }
+
+    template<typename T>
+    void put(std::ostream &out, const T *values, size_t n) {
+        out.write(reinterpret_cast<const char*>(values), n*sizeof(T));
+        position += n*sizeof(T);
+    }
+
+    void pad(std::ostream &out) {
+        static const char zeros[8] = { 0 };
+        auto rem = position % 8;
+        if (rem) {
+            out.write(zeros, 8 - rem);
+            position += 8 - rem;
+        }
+    }
+
+    template<typename T> std::vector<T> &coords();
+    template<typename T> std::vector<T> &other_coords();
+
+    uint32_t coord_bytes;
+    uint64_t position = 0; // bytes written so far
+    std::vector<uint64_t> offsets; // frame offsets
+    std::vector<uint64_t> starts, fill, counts; // per entity scratch
+    std::vector<float> xs32, ys32;
+    std::vector<double> xs64, ys64;
+};
+
+template<> inline std::vector<float> &BinarySnapshotFormat::coords<float>() { return xs32; }
+template<> inline std::vector<float> &BinarySnapshotFormat::other_coords<float>() { return ys32; }
+template<> inline std::vector<double> &BinarySnapshotFormat::coords<double>() { return xs64; }
+template<> inline std::vector<double> &BinarySnapshotFormat::other_coords<double>() { return ys64; }
+
+/*
+ * Memory-mapped reader of binary snapshot files. Coordinate arrays point directly into
+ * the mapping; use xs<float>(e) or xs<double>(e) according to coord_bytes().
+ */
+class BinarySnapshotReader {
+public:
+    class Frame {
+    public:
+        Frame(const char *d, uint32_t entities, uint32_t cb) : data(d), entity_count(entities), coord_bytes(cb) {}
+
+        double time() const { return load<double>(data); }
+        uint64_t events() const { return load<uint64_t>(data + 8); }
+        uint64_t count(uint32_t e) const { return load<uint64_t>(data + 16 + 8*e); }
+
+        template<typename T> const T *xs(uint32_t e) const { return reinterpret_cast<const T*>(section(e)); }
+        template<typename T> const T *ys(uint32_t e) const { return reinterpret_cast<const T*>(section(e) + count(e)*coord_bytes); }
+    private:
+        template<typename T> static T load(const char *p) { T v; std::memcpy(&v, p, sizeof(T)); return v; }
+
+        const char *section(uint32_t e) const {
+            auto p = data + 16 + 8*entity_count;
+            for(auto i = 0u; i<e; i++) p += 2*count(i)*coord_bytes;
+            return p;
+        }
+
+        const char *data;
+        uint32_t entity_count, coord_bytes;
+    };
+
+    explicit BinarySnapshotReader(const std::string &fname) {
+        fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open binary snapshot file '" + fname + "'");
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(BinarySnapshotHeader) + sizeof(BinarySnapshotFooter)) {
+            ::close(fd);
+            throw std::runtime_error("Binary snapshot file '" + fname + "' is too short");
+        }
+        size = st.st_size;
+        void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Could not map binary snapshot file '" + fname + "'");
+        }
+        base = static_cast<const char*>(m);
+        std::memcpy(&header, base, sizeof(header));
+        BinarySnapshotFooter footer;
+        std::memcpy(&footer, base + size - sizeof(footer), sizeof(footer));
+        if (std::memcmp(header.magic, BINARY_SNAPSHOT_MAGIC, 8) != 0 ||
+            std::memcmp(footer.magic, BINARY_SNAPSHOT_INDEX_MAGIC, 8) != 0) {
+            unmap();
+            throw std::runtime_error("'" + fname + "' is not a finished binary snapshot file");
+        }
+        frame_count = footer.frames;
+        index = reinterpret_cast<const uint64_t*>(base + footer.index_offset);
+    }
+
+    ~BinarySnapshotReader() { unmap(); }
+    BinarySnapshotReader(const BinarySnapshotReader&) = delete;
+    BinarySnapshotReader &operator=(const BinarySnapshotReader&) = delete;
+
+    uint64_t frames() const { return frame_count; }
+    uint32_t entities() const { return header.entities; }
+    uint32_t coord_bytes() const { return header.coord_bytes; }
+    double U() const { return header.U; }
+
+    Frame frame(uint64_t i) const {
+        if (i >= frame_count) throw std::runtime_error("Binary snapshot frame index out of range");
+        return Frame(base + index[i], header.entities, header.coord_bytes);
+    }
+
+private:
+    void unmap() {
+        if (base) munmap(const_cast<char*>(base), size);
+        if (fd >= 0) ::close(fd);
+        base = nullptr;
+        fd = -1;
+    }
+
+    int fd = -1;
+    size_t size = 0;
+    const char *base = nullptr;
+    BinarySnapshotHeader header;
+    uint64_t frame_count = 0;
+    const uint64_t *index = nullptr;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __CHECKPOINT_H_
+#define __CHECKPOINT_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+namespace pp {
+
+/*
+ * Binary checkpoints of a simulation (see BasicSimulator::write_checkpoint).
+ *
+ * A checkpoint is the magic "PPCKPT1", a version number and then the sections written by the
+ * simulator and by the application, each as plain native-endian values: checkpoints are for
+ * restarting on the same machine (or the same kind of machine) and build, not for archiving.
+ * Vectors and strings are prefixed by their length as uint64.
+ */
+static constexpr char CHECKPOINT_MAGIC[8] = "PPCKPT1";
+static constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(std::ostream &o) : out(o) {}
+
+    void header() {
+        out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        value(CHECKPOINT_VERSION);
+    }
+
+    template<typename T>
+    void value(const T &v) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be checkpointed");
+        out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    template<typename T>
+    void vector(const std::vector<T> &vs) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be checkpointed");
+        value<uint64_t>(vs.size());
+        out.write(reinterpret_cast<const char*>(vs.data()), vs.size()*sizeof(T));
+    }
+
+    void string(const std::string &s) {
+        value<uint64_t>(s.size());
+        out.write(s.data(), s.size());
+    }
+
+    bool good() const { return bool(out); }
+
+private:
+    std::ostream &out;
+};
+
+class CheckpointReader {
+public:
+    explicit CheckpointReader(std::istream &i) : in(i) {}
+
+    void header() {
+        char magic[sizeof(CHECKPOINT_MAGIC)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+            throw std::runtime_error("Not a checkpoint file");
+        }
+        if (value<uint32_t>() != CHECKPOINT_VERSION) {
+            throw std::runtime_error("Unsupported checkpoint version");
+        }
+    }
+
+    template<typename T>
+    T value() {
+        T v;
+        if (!in.read(reinterpret_cast<char*>(&v), sizeof(T))) throw std::runtime_error("Truncated checkpoint");
+        return v;
+    }
+
+    template<typename T>
+    std::vector<T> vector() {
+        std::vector<T> vs(size());
+        if (!in.read(reinterpret_cast<char*>(vs.data()), vs.size()*sizeof(T))) throw std::runtime_error("Truncated checkpoint");
+        return vs;
+    }
+
+    std::string string() {
+        std::string s(size(), '\0');
+        if (!in.read(&s[0], s.size())) throw std::runtime_error("Truncated checkpoint");
+        return s;
+    }
+
+    /* Check a value that must agree with the restoring simulator, e.g. a bucket count */
+    template<typename T>
+    void expect(const T &v, const char *what) {
+        if (value<T>() != v) {
+            throw std::runtime_error(std::string("Checkpoint does not match the simulation: different ") + what);
+        }
+    }
+
+private:
+    uint64_t size() {
+        auto n = value<uint64_t>();
+        if (n > (uint64_t(1) << 40)) throw std::runtime_error("Corrupt checkpoint");
+        return n;
+    }
+
+    std::istream &in;
+};
+
+} // namespace
+
+#endif
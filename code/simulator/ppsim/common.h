@@ -6,7 +6,10 @@
 #include <sstream>
 #include <random>
 #include <list>
+#include <new>
+#include <type_traits>
 #include <boost/pool/pool_alloc.hpp>
+#include <boost/pool/pool.hpp>
 #include <boost/pool/object_pool.hpp>
 #include <boost/functional/hash.hpp>
 
@@ -40,6 +43,26 @@ using uint_t = uint64_t;
 using coord_t = double; 
 class Point;
 
+/*
+ * COMPACT POINTS.
+ *
+ * With COMPACT_POINTS set, points store single precision coordinates, an 8-bit entity and
+ * 32-bit bucket/slot indices, and compute their hash on demand (20 instead of 48 bytes per point).
+ * All distance computations are still done in coord_t.
+ */
+#ifndef COMPACT_POINTS
+#define COMPACT_POINTS 0
+#endif
+#if COMPACT_POINTS
+using point_coord_t = float;
+using point_entity_t = uint8_t;
+using point_index_t = uint32_t;
+#else
+using point_coord_t = coord_t;
+using point_entity_t = uint_t;
+using point_index_t = uint_t;
+#endif
+
 /* BUFFER TYPES & MEMORY POOLING */
 using pool_allocator_t = boost::default_user_allocator_new_delete;
 
@@ -54,7 +77,33 @@ using pool_allocator_t = boost::default_user_allocator_new_delete;
 #define allocated_structure(x,y) x<y,boost::fast_pool_allocator<y,pool_allocator_t,boost::details::pool::null_mutex>>
 #endif
 
-using bucket_t = allocated_structure(std::list,Point*);
+/*
+ * Pool for fixed size objects. Unlike boost::object_pool, releasing an object is O(1)
+ * (object_pool keeps its free list ordered). Objects that are still allocated when the pool
+ * is destroyed are not destructed, hence T needs to be trivially destructible.
+ */
+template<typename T>
+class ObjectPool {
+public:
+    static_assert(std::is_trivially_destructible<T>::value, "ObjectPool can only hold trivially destructible objects");
+    ObjectPool() : pool(sizeof(T)) {}
+
+    template<typename... Args>
+    T *construct(Args&&... args) {
+        void *memory = pool.malloc();
+        if (memory == nullptr) throw std::bad_alloc();
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *t) {
+        t->~T();
+        pool.free(t);
+    }
+private:
+    boost::pool<pool_allocator_t> pool;
+};
+
+using bucket_t = allocated_structure(std::vector,Point*);
 using bucket_list_t =  allocated_structure(std::vector,bucket_t);
 using point_query_t = allocated_structure(std::vector,Point*);
 using point_del_buf_t = allocated_structure(std::vector,Point*);
@@ -3,7 +3,8 @@
 
 #include "common.h"
 #include "point.h"
-#include "accumulator.h"
+#include "sumtree.h"
+#include "checkpoint.h"
 
 #include <unordered_map>
 #include <unordered_set>
@@ -32,8 +33,8 @@ struct NConfiguration {
         return points[index]; 
     }
 
-    using set_t = std::list<NConfiguration*,boost::fast_pool_allocator<NConfiguration*>>;
-    typename set_t::iterator it;
+    using set_t = std::vector<NConfiguration*>;
+    uint_t slot; // index of the configuration within its bucket
 private:
     NConfiguration(NConfiguration &) {} // Prevent copying
 };
@@ -52,17 +53,17 @@ public:
     using Configuration = NConfiguration<IN>;
     ConfigurationSet() : ConfigurationSet(DEFAULT_BUCKET_COUNT) {}
 
-    ConfigurationSet(uint_t bc) : accumulator(Accumulator<unsigned long>(bc, log2(bc))) {
+    ConfigurationSet(uint_t bc) : accumulator(bc) {
         buckets.resize(bc);
     }
 
     double get_total_weight() const { 
-        return accumulator.get_nodes()[0]; 
+        return accumulator.total(); 
     }
 
     uint_t size() const { 
         auto total = 0;
-        for(auto s : buckets) {
+        for(const auto &s : buckets) {
             total += s.size();
         }
         return total;
@@ -82,8 +83,8 @@ public:
         DMSG("Adding configuration " << *c );
         assert(!contains(c) /* Attempting to add a configuration that already exists */);
         auto b = get_bucket(c);
+        c->slot = buckets[b].size();
         buckets[b].push_back(c);
-        c->it = std::prev(buckets[b].end());
         accumulator.increment(b, 1); // c->weight);
         assert(contains(c) /* Configuration set should contain a configuration that was just added */);
     }
@@ -92,8 +93,11 @@ public:
         DMSG("remove(" << c << ")");
         assert(contains(c) && "Attempting to REMOVE a configuration that does not exist");
         auto b = get_bucket(c);
-        auto it = c->it;
-        buckets[b].erase(it);
+        /* swap-remove: the last configuration of the bucket takes over the slot of c */
+        auto last = buckets[b].back();
+        buckets[b][c->slot] = last;
+        last->slot = c->slot;
+        buckets[b].pop_back();
         accumulator.increment(b, -1); // -c->weight);
         assert(!contains(c) && "Configuration set should not contain a configuration that was just removed");
     }
@@ -191,29 +195,87 @@ public:
     }
 
     Configuration *get_nth(int n) const {
-        assert(get_count()>=n);
-        auto r = accumulator.find_start_location(n);
-        auto start = r.first;
-        auto remaining = r.second;
-
-        for(auto i = start; i<buckets.size(); i++) {
-            for(auto c : buckets[i]) {
-                if (remaining == 0) return c;
-                remaining -= 1;
+        assert(n >= 0 && n < get_count());
+        /* one leaf per bucket: the accumulator gives the bucket, the rest is a direct index */
+        auto r = accumulator.find_start_location(n+1);
+        auto b = r.first;
+        auto index = r.second - 1;
+
+        if (b >= buckets.size() || index >= buckets[b].size()) {
+            /* Something went wrong! */
+            std::stringstream s;
+            s <<"Could not find nth configuration";
+            s << "in get_nth(" << n << ")" << " bucket = " << b << " index = " << index;
+            s << " count=" << get_count();
+            throw std::runtime_error(s.str());
+        }
+        return buckets[b][index];
+    }
+
+    uint_t get_count() const { 
+        return accumulator.total(); 
+    }
+
+    /* 
+     * Make this empty set a copy of o with each point q replaced by f(q). The copied points must
+     * hash like the originals (same coordinates and entity), so every configuration keeps its bucket.
+     */
+    template<typename F>
+    void copy_from(const ConfigurationSet &o, F f) {
+        if (get_count() > 0 || buckets.size() != o.buckets.size()) {
+            throw std::runtime_error("ConfigurationSet::copy_from: the target must be empty and have the same bucket count");
+        }
+        for(auto b = 0u; b<buckets.size(); b++) {
+            buckets[b].reserve(o.buckets[b].size());
+            for(auto c : o.buckets[b]) {
+                auto n = pool.construct();
+                for(auto i = 0u; i<IN; i++) {
+                    n->points[i] = f(c->points[i]);
+                }
+                n->weight = c->weight;
+                n->slot = c->slot;
+                buckets[b].push_back(n);
+                assert(get_bucket(n) == b);
+            }
+            if (!buckets[b].empty()) {
+                accumulator.increment(b, buckets[b].size());
             }
         }
+    }
 
-        /* Something went wrong! */
-        DMSG("remaining " << remaining);
-        std::stringstream s;
-        s <<"Could not find nth configuration";
-        s << "in get_nth(" << n << ")" << " remaining = " << remaining;
-        s << " count=" << get_count();
-        throw std::runtime_error(s.str());
+    /* The configurations in bucket order, with each point written by ref(p) and read back by point() */
+    template<typename F>
+    void write_checkpoint(CheckpointWriter &w, F ref) const {
+        w.value<uint64_t>(buckets.size());
+        for(auto &b : buckets) {
+            w.value<uint64_t>(b.size());
+            for(auto c : b) {
+                w.value(c->weight);
+                for(auto p : c->points) ref(p);
+            }
+        }
     }
 
-    uint_t get_count() const { 
-        return accumulator.get_nodes()[0]; 
+    template<typename F>
+    void read_checkpoint(CheckpointReader &r, F point) {
+        if (get_count() > 0) {
+            throw std::runtime_error("ConfigurationSet::read_checkpoint: the set must be empty");
+        }
+        r.expect<uint64_t>(buckets.size(), "configuration buckets");
+        for(auto b = 0u; b<buckets.size(); b++) {
+            buckets[b].resize(r.value<uint64_t>());
+            for(auto i = 0u; i<buckets[b].size(); i++) {
+                auto c = pool.construct();
+                c->weight = r.value<double>();
+                for(auto &p : c->points) p = point();
+                c->slot = i;
+                buckets[b][i] = c;
+                if (get_bucket(c) != b) throw std::runtime_error("Checkpoint has a configuration outside its bucket");
+            }
+            if (!buckets[b].empty()) {
+                accumulator.increment(b, buckets[b].size());
+            }
+        }
     }
 
     void print_stats() const {
@@ -224,7 +286,7 @@ public:
             sum += i;
         }
         double avg = sum / accumulator.leaves().size();
-        std::cout << "Total: " << accumulator.get_nodes()[0] << " Min: " << min << " Max: " << max << " Avg: " << avg << std::endl;
+        std::cout << "Total: " << accumulator.total() << " Min: " << min << " Max: " << max << " Avg: " << avg << std::endl;
     }
 
 protected:
@@ -241,9 +303,9 @@ protected:
     }
 
     static constexpr uint_t DEFAULT_BUCKET_COUNT = 4096;
-    boost::object_pool<Configuration> pool;
+    ObjectPool<Configuration> pool;
     std::vector<typename Configuration::set_t,boost::fast_pool_allocator<typename Configuration::set_t>> buckets;
-    Accumulator<unsigned long> accumulator;
+    accumulator_t<unsigned long> accumulator;
 };
 
 }
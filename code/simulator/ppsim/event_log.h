@@ -0,0 +1,442 @@
+#ifndef __EVENT_LOG_H_
+#define __EVENT_LOG_H_
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#include "common.h"
+#include "point.h"
+#include "simulation_state.h"
+#include "writers.h"
+#include "async_writer.h"
+
+namespace pp {
+
+/*
+ * Event log files record every event of a run, so that the state can be rebuilt at any time.
+ *
+ *   header    EventLogHeader (32 bytes)
+ *   records   varint kind, followed by
+ *               KEYFRAME: double time, varint events, varint next_id, varint n, then n points
+ *                         sorted by id: varint id - previous id, varint entity, varint qx, varint qy
+ *               EVENT:    (kind = EVENT + process id) float time - previous time, varint removed
+ *                         count, for each removed point varint next_id - 1 - id, varint added count,
+ *                         for each added point varint entity, zigzag varint dqx, zigzag varint dqy
+ *               END:      double time, varint events
+ *   index     for each keyframe: double time, uint64 file offset
+ *   footer    EventLogFooter (24 bytes)
+ *
+ * Points get consecutive ids in the order they appear (next_id is the next unused id). Coordinates
+ * are quantized to 'bits' bits over [0, U); added points are stored relative to the first removed
+ * point of the event (wrapped around the torus) or to the origin if the event removes nothing.
+ * Event times are stored as single precision increments of the time as reconstructed from the
+ * log, so that rounding errors do not accumulate between keyframes.
+ */
+struct EventLogHeader {
+    char magic[8]; // "PPEVLOG"
+    uint32_t version;
+    uint32_t bits; // coordinate quantization
+    uint32_t entities; // entity ids are 0 .. entities-1
+    uint32_t reserved;
+    double U;
+};
+
+struct EventLogFooter {
+    uint64_t index_offset;
+    uint64_t keyframes;
+    char magic[8]; // "PPEVLGIX"
+};
+
+static_assert(sizeof(EventLogHeader) == 32, "Unexpected event log header size");
+static_assert(sizeof(EventLogFooter) == 24, "Unexpected event log footer size");
+
+static constexpr char EVENT_LOG_MAGIC[8] = "PPEVLOG";
+static constexpr char EVENT_LOG_INDEX_MAGIC[8] = { 'P', 'P', 'E', 'V', 'L', 'G', 'I', 'X' };
+
+enum EventLogRecord { EVENT_LOG_KEYFRAME = 0, EVENT_LOG_END = 1, EVENT_LOG_EVENT = 2 };
+
+inline void put_varint(std::string &buffer, uint64_t v) {
+    while (v >= 0x80) {
+        buffer.push_back(char((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    buffer.push_back(char(v));
+}
+
+inline uint64_t get_varint(std::istream &in) {
+    uint64_t v = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        auto c = in.get();
+        if (c == std::char_traits<char>::eof()) throw std::runtime_error("Truncated event log");
+        v |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80)) return v;
+    }
+    throw std::runtime_error("Invalid varint in event log");
+}
+
+inline uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+template<typename T>
+void put_raw(std::string &buffer, T v) {
+    buffer.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+T get_raw(std::istream &in) {
+    T v;
+    if (!in.read(reinterpret_cast<char*>(&v), sizeof(T))) throw std::runtime_error("Truncated event log");
+    return v;
+}
+
+/* Coordinates in [0, U) as integers in [0, 2^bits) */
+struct CoordQuantizer {
+    CoordQuantizer(double u = 1, uint_t b = 24) : U(u), bits(b), cells(uint64_t(1) << b), scale(cells / u) {}
+
+    inline uint64_t quantize(double x) const { return std::min<uint64_t>(uint64_t(std::max(x, 0.0) * scale), cells-1); }
+    inline coord_t value(uint64_t q) const { return coord_t((q + 0.5) / scale); }
+
+    /* Shortest difference a - b around the torus */
+    inline int64_t difference(uint64_t a, uint64_t b) const {
+        auto d = (a - b) & (cells - 1);
+        return d >= cells/2 ? int64_t(d) - int64_t(cells) : int64_t(d);
+    }
+    inline uint64_t add(uint64_t a, int64_t d) const { return (a + uint64_t(d)) & (cells - 1); }
+
+    double U;
+    uint_t bits;
+    uint64_t cells;
+    double scale;
+};
+
+/*
+ * Writer that records every event (see the layout above). Keyframes with the full state are
+ * written at the start and every keyframe_interval time units; they let readers start replaying
+ * anywhere without going through the whole log.
+ */
+class EventLogWriter : public Writer, public EventListener {
+public:
+    EventLogWriter(std::shared_ptr<std::ostream> o, double keyframe_interval, uint_t bits = 24)
+        : Writer(keyframe_interval), out(o), bits(bits) {}
+
+    void start(SimulationState &s) {
+        quantizer = CoordQuantizer(s.U(), bits);
+        EventLogHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, EVENT_LOG_MAGIC, sizeof(h.magic));
+        h.version = 1;
+        h.bits = bits;
+        h.entities = s.get_max_entities()+1;
+        h.U = s.U();
+        buffer.assign(reinterpret_cast<const char*>(&h), sizeof(h));
+        flush_buffer();
+
+        ids.clear();
+        next_id = 0;
+        for(auto p : s.enumerate()) {
+            ids[p] = next_id++;
+        }
+        write_keyframe(s, s.stats.time);
+    }
+
+    void write(SimulationState &s, double t) {
+        write_keyframe(s, t);
+    }
+
+    void end(SimulationState &s) {
+        put_varint(buffer, EVENT_LOG_END);
+        put_raw<double>(buffer, s.stats.time);
+        put_varint(buffer, s.stats.total_events);
+        flush_buffer();
+
+        EventLogFooter f;
+        f.index_offset = position;
+        f.keyframes = keyframes.size();
+        std::memcpy(f.magic, EVENT_LOG_INDEX_MAGIC, sizeof(f.magic));
+        for(auto &k : keyframes) {
+            put_raw<double>(buffer, k.first);
+            put_raw<uint64_t>(buffer, k.second);
+        }
+        buffer.append(reinterpret_cast<const char*>(&f), sizeof(f));
+        flush_buffer();
+        out->flush();
+    }
+
+    void event(const SimulationState &s, uint_t rid, const point_del_buf_t &removed, const point_add_buf_t &added) {
+        put_varint(buffer, EVENT_LOG_EVENT + rid);
+        float dt = float(s.stats.time - time);
+        time += dt;
+        put_raw<float>(buffer, dt);
+
+        uint64_t rx = 0, ry = 0;
+        put_varint(buffer, removed.size());
+        for(auto i = 0u; i<removed.size(); i++) {
+            auto it = ids.find(removed[i]);
+            if (it == ids.end()) throw std::runtime_error("EventLogWriter: removed point was never logged");
+            put_varint(buffer, next_id - 1 - it->second);
+            if (i == 0) {
+                rx = quantizer.quantize((*removed[i])[0]);
+                ry = quantizer.quantize((*removed[i])[1]);
+            }
+            ids.erase(it);
+        }
+
+        put_varint(buffer, added.size());
+        for(auto p : added) {
+            put_varint(buffer, p->get_entity());
+            put_varint(buffer, zigzag(quantizer.difference(quantizer.quantize((*p)[0]), rx)));
+            put_varint(buffer, zigzag(quantizer.difference(quantizer.quantize((*p)[1]), ry)));
+            ids[p] = next_id++;
+        }
+
+        if (buffer.size() >= FLUSH_SIZE) flush_buffer();
+    }
+
+private:
+    static constexpr size_t FLUSH_SIZE = 1 << 16;
+
+    struct KeyPoint {
+        uint64_t id;
+        uint_t entity;
+        uint64_t qx, qy;
+        bool operator<(const KeyPoint &o) const { return id < o.id; }
+    };
+
+    void write_keyframe(SimulationState &s, double t) {
+        flush_buffer();
+        keyframes.push_back(std::make_pair(t, position));
+        time = t;
+
+        key_points.clear();
+        for(auto p : s.enumerate()) {
+            key_points.push_back(KeyPoint { ids.at(p), p->get_entity(), quantizer.quantize((*p)[0]), quantizer.quantize((*p)[1]) });
+        }
+        std::sort(key_points.begin(), key_points.end());
+
+        put_varint(buffer, EVENT_LOG_KEYFRAME);
+        put_raw<double>(buffer, t);
+        put_varint(buffer, s.stats.total_events);
+        put_varint(buffer, next_id);
+        put_varint(buffer, key_points.size());
+        uint64_t previous = 0;
+        for(auto &k : key_points) {
+            put_varint(buffer, k.id - previous);
+            put_varint(buffer, k.entity);
+            put_varint(buffer, k.qx);
+            put_varint(buffer, k.qy);
+            previous = k.id;
+        }
+        flush_buffer();
+    }
+
+    void flush_buffer() {
+        out->write(buffer.data(), buffer.size());
+        position += buffer.size();
+        buffer.clear();
+    }
+
+    std::shared_ptr<std::ostream> out;
+    uint_t bits;
+    CoordQuantizer quantizer;
+    std::unordered_map<const Point*, uint64_t> ids; // id of each live point
+    uint64_t next_id = 0;
+    double time = 0; // time of the last record as reconstructed by readers
+    std::string buffer; // encoded records not yet written
+    uint64_t position = 0; // bytes written so far
+    std::vector<std::pair<double, uint64_t>> keyframes; // time and offset of each keyframe
+    std::vector<KeyPoint> key_points;
+};
+
+/*
+ * Replays an event log. next() applies one record at a time; advance_to(t) and seek(t) give
+ * the state at time t, i.e. after all events at or before t. seek() can also go backwards and
+ * skips to the closest keyframe, but needs a seekable stream of a finished log.
+ */
+class EventLogReader {
+public:
+    struct LoggedPoint {
+        uint_t entity;
+        uint64_t qx, qy;
+    };
+
+    explicit EventLogReader(std::istream &i) : in(i) {
+        auto h = get_raw<EventLogHeader>(in);
+        if (std::memcmp(h.magic, EVENT_LOG_MAGIC, sizeof(h.magic)) != 0) {
+            throw std::runtime_error("Not an event log");
+        }
+        header = h;
+        quantizer = CoordQuantizer(h.U, h.bits);
+        counts.resize(h.entities, 0);
+        read_index();
+    }
+
+    double U() const { return header.U; }
+    uint_t entities() const { return header.entities; }
+    double time() const { return current_time; }
+    uint64_t events() const { return event_count; }
+    bool finished() const { return done; }
+    uint_t get_count(uint_t entity) const { return counts.at(entity); }
+    const std::map<uint64_t, LoggedPoint> &points() const { return live; }
+    const std::vector<std::pair<double, uint64_t>> &keyframes() const { return index; }
+    coord_t x(const LoggedPoint &p) const { return quantizer.value(p.qx); }
+    coord_t y(const LoggedPoint &p) const { return quantizer.value(p.qy); }
+
+    /* Apply the next record; false at the end of the log */
+    bool next() {
+        if (!peek()) return false;
+        apply();
+        return true;
+    }
+
+    /* Apply all records at or before time t */
+    void advance_to(double t) {
+        while (peek() && pending_time <= t) {
+            apply();
+        }
+    }
+
+    void seek(double t) {
+        auto k = std::upper_bound(index.begin(), index.end(), std::make_pair(t, std::numeric_limits<uint64_t>::max()));
+        if (k != index.begin() && (t < current_time || std::prev(k)->first > current_time)) {
+            in.clear();
+            in.seekg(std::prev(k)->second);
+            pending = false;
+            done = false;
+        } else if (t < current_time) {
+            throw std::runtime_error("Cannot seek backwards in an event log without an index");
+        }
+        advance_to(t);
+    }
+
+    /* Copy the current state for a snapshot format */
+    void capture(StateSnapshot &s, double t, StateSnapshot::Kind k) const {
+        s.kind = k;
+        s.time = t;
+        s.U = header.U;
+        s.events = event_count;
+        s.counts = counts;
+        s.points.clear();
+        for(auto &p : live) {
+            s.points.push_back(StateSnapshot::PointRecord { x(p.second), y(p.second), p.second.entity });
+        }
+    }
+
+private:
+    /* Read the kind and time of the next record */
+    bool peek() {
+        if (pending) return true;
+        if (done || in.peek() == std::char_traits<char>::eof()) return false;
+        pending_kind = get_varint(in);
+        if (pending_kind >= EVENT_LOG_EVENT) {
+            pending_time = current_time + get_raw<float>(in);
+        } else {
+            pending_time = get_raw<double>(in);
+        }
+        pending = true;
+        return true;
+    }
+
+    void apply() {
+        pending = false;
+        current_time = pending_time;
+        if (pending_kind == EVENT_LOG_KEYFRAME) {
+            read_keyframe();
+        } else if (pending_kind == EVENT_LOG_END) {
+            event_count = get_varint(in);
+            done = true;
+        } else {
+            read_event();
+        }
+    }
+
+    void read_keyframe() {
+        event_count = get_varint(in);
+        next_id = get_varint(in);
+        auto n = get_varint(in);
+        live.clear();
+        std::fill(counts.begin(), counts.end(), 0);
+        uint64_t id = 0;
+        for(auto i = 0u; i<n; i++) {
+            id += get_varint(in);
+            LoggedPoint p;
+            p.entity = get_varint(in);
+            p.qx = get_varint(in);
+            p.qy = get_varint(in);
+            live.insert(live.end(), std::make_pair(id, p));
+            counts.at(p.entity)++;
+        }
+    }
+
+    void read_event() {
+        event_count++;
+        uint64_t rx = 0, ry = 0;
+        auto removed = get_varint(in);
+        for(auto i = 0u; i<removed; i++) {
+            auto it = live.find(next_id - 1 - get_varint(in));
+            if (it == live.end()) throw std::runtime_error("Event log removes an unknown point");
+            if (i == 0) {
+                rx = it->second.qx;
+                ry = it->second.qy;
+            }
+            counts[it->second.entity]--;
+            live.erase(it);
+        }
+        auto added = get_varint(in);
+        for(auto i = 0u; i<added; i++) {
+            LoggedPoint p;
+            p.entity = get_varint(in);
+            p.qx = quantizer.add(rx, unzigzag(get_varint(in)));
+            p.qy = quantizer.add(ry, unzigzag(get_varint(in)));
+            live.insert(live.end(), std::make_pair(next_id++, p));
+            counts.at(p.entity)++;
+        }
+    }
+
+    void read_index() {
+        auto start = in.tellg();
+        if (start == std::streampos(-1) || !in.seekg(-std::streamoff(sizeof(EventLogFooter)), std::ios::end)) {
+            in.clear();
+            return;
+        }
+        EventLogFooter f;
+        in.read(reinterpret_cast<char*>(&f), sizeof(f));
+        if (in && std::memcmp(f.magic, EVENT_LOG_INDEX_MAGIC, sizeof(f.magic)) == 0) {
+            in.seekg(f.index_offset);
+            for(auto i = 0u; i<f.keyframes; i++) {
+                auto t = get_raw<double>(in);
+                index.push_back(std::make_pair(t, get_raw<uint64_t>(in)));
+            }
+        }
+        in.clear();
+        in.seekg(start);
+    }
+
+    std::istream &in;
+    EventLogHeader header;
+    CoordQuantizer quantizer;
+    std::map<uint64_t, LoggedPoint> live; // points by id
+    std::vector<uint_t> counts; // points of each entity
+    uint64_t next_id = 0;
+    double current_time = 0;
+    uint64_t event_count = 0;
+    bool done = false;
+    std::vector<std::pair<double, uint64_t>> index; // keyframe times and offsets
+
+    bool pending = false; // kind and time of the next record have been read
+    uint64_t pending_kind = 0;
+    double pending_time = 0;
+};
+
+} // namespace
+
+#endif
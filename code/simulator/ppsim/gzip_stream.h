@@ -0,0 +1,209 @@
+#ifndef __GZIP_STREAM_H_
+#define __GZIP_STREAM_H_
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace pp {
+
+/*
+ * Stream buffer that gzip-compresses everything written through it into another stream
+ * (deflate as data arrives, no temporary uncompressed file). The output is a standard
+ * .gz file readable with gunzip or Python's gzip module. Not seekable.
+ */
+class GzipOutputBuffer : public std::streambuf {
+public:
+    explicit GzipOutputBuffer(std::unique_ptr<std::ostream> s, int level = Z_DEFAULT_COMPRESSION, std::size_t buffer_size = 1 << 16)
+        : sink(std::move(s)), in(buffer_size), out(buffer_size) {
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        /* 15 + 16: largest window with a gzip header */
+        if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("GzipOutputBuffer: deflateInit2 failed");
+        }
+        setp(in.data(), in.data() + in.size());
+    }
+
+    ~GzipOutputBuffer() {
+        close();
+    }
+
+    /* Compress what is buffered and finish the gzip stream; further writes fail */
+    void close() {
+        if (closed) return;
+        deflate_buffer(Z_FINISH);
+        deflateEnd(&zs);
+        sink->flush();
+        closed = true;
+    }
+
+protected:
+    int overflow(int c) {
+        if (closed || !deflate_buffer(Z_NO_FLUSH)) return traits_type::eof();
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    /* Flushing makes everything written so far decompressible (at a small cost in ratio) */
+    int sync() {
+        if (closed) return 0;
+        if (!deflate_buffer(Z_SYNC_FLUSH)) return -1;
+        sink->flush();
+        return 0;
+    }
+
+private:
+    bool deflate_buffer(int flush) {
+        zs.next_in = reinterpret_cast<Bytef*>(pbase());
+        zs.avail_in = pptr() - pbase();
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(out.data());
+            zs.avail_out = out.size();
+            auto r = deflate(&zs, flush);
+            if (r == Z_STREAM_ERROR) return false;
+            sink->write(out.data(), out.size() - zs.avail_out);
+        } while (zs.avail_out == 0 || (flush == Z_FINISH && zs.avail_in > 0));
+        setp(in.data(), in.data() + in.size());
+        return bool(*sink);
+    }
+
+    std::unique_ptr<std::ostream> sink;
+    std::vector<char> in, out;
+    z_stream zs;
+    bool closed = false;
+};
+
+/* Stream buffer that decompresses a gzip stream (or passes through uncompressed data) */
+class GzipInputBuffer : public std::streambuf {
+public:
+    explicit GzipInputBuffer(std::unique_ptr<std::istream> s, std::size_t buffer_size = 1 << 16)
+        : source(std::move(s)), in(buffer_size), out(buffer_size) {
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        zs.next_in = Z_NULL;
+        zs.avail_in = 0;
+        /* 15 + 32: detect gzip or zlib headers automatically */
+        if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+            throw std::runtime_error("GzipInputBuffer: inflateInit2 failed");
+        }
+        setg(out.data(), out.data(), out.data());
+    }
+
+    ~GzipInputBuffer() {
+        inflateEnd(&zs);
+    }
+
+protected:
+    int underflow() {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        std::size_t produced = 0;
+        while (produced == 0 && !finished) {
+            if (zs.avail_in == 0) {
+                source->read(in.data(), in.size());
+                zs.next_in = reinterpret_cast<Bytef*>(in.data());
+                zs.avail_in = source->gcount();
+                if (zs.avail_in == 0) break; // truncated input
+            }
+            zs.next_out = reinterpret_cast<Bytef*>(out.data());
+            zs.avail_out = out.size();
+            auto r = inflate(&zs, Z_NO_FLUSH);
+            if (r == Z_STREAM_END) {
+                /* concatenated gzip members (e.g. appended files) continue the stream */
+                if (zs.avail_in > 0 || source->peek() != std::char_traits<char>::eof()) {
+                    inflateReset(&zs);
+                } else {
+                    finished = true;
+                }
+            } else if (r != Z_OK && r != Z_BUF_ERROR) {
+                throw std::runtime_error("GzipInputBuffer: corrupt gzip data");
+            }
+            produced = out.size() - zs.avail_out;
+        }
+        setg(out.data(), out.data(), out.data() + produced);
+        return produced ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+    }
+
+private:
+    std::unique_ptr<std::istream> source;
+    std::vector<char> in, out;
+    z_stream zs;
+    bool finished = false;
+};
+
+/* std::ostream writing gzip data to a file */
+class GzipOutputStream : public std::ostream {
+public:
+    explicit GzipOutputStream(const std::string &fname, int level = Z_DEFAULT_COMPRESSION)
+        : std::ostream(nullptr) {
+        std::unique_ptr<std::ostream> file(new std::ofstream(fname, std::ios::out | std::ios::binary));
+        if (file->fail()) {
+            setstate(std::ios::failbit);
+            return;
+        }
+        buffer.reset(new GzipOutputBuffer(std::move(file), level));
+        rdbuf(buffer.get());
+    }
+
+    ~GzipOutputStream() {
+        close();
+    }
+
+    void close() {
+        if (buffer) buffer->close();
+    }
+
+private:
+    std::unique_ptr<GzipOutputBuffer> buffer;
+};
+
+/* std::istream reading a gzip compressed file */
+class GzipInputStream : public std::istream {
+public:
+    explicit GzipInputStream(const std::string &fname) : std::istream(nullptr) {
+        std::unique_ptr<std::istream> file(new std::ifstream(fname, std::ios::in | std::ios::binary));
+        if (file->fail()) {
+            setstate(std::ios::failbit);
+            return;
+        }
+        buffer.reset(new GzipInputBuffer(std::move(file)));
+        rdbuf(buffer.get());
+    }
+
+private:
+    std::unique_ptr<GzipInputBuffer> buffer;
+};
+
+inline bool has_gzip_extension(const std::string &fname) {
+    return fname.size() > 3 && fname.compare(fname.size() - 3, 3, ".gz") == 0;
+}
+
+/* Open a file for writing, compressing it if the name ends with .gz */
+inline std::shared_ptr<std::ostream> open_output_stream(const std::string &fname) {
+    if (has_gzip_extension(fname)) {
+        return std::make_shared<GzipOutputStream>(fname);
+    }
+    return std::make_shared<std::ofstream>(fname, std::ios::out | std::ios::binary);
+}
+
+/* Open a file for reading, decompressing it if the name ends with .gz */
+inline std::shared_ptr<std::istream> open_input_stream(const std::string &fname) {
+    if (has_gzip_extension(fname)) {
+        return std::make_shared<GzipInputStream>(fname);
+    }
+    return std::make_shared<std::ifstream>(fname, std::ios::in | std::ios::binary);
+}
+
+} // namespace
+
+#endif
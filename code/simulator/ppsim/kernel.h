@@ -6,6 +6,7 @@
 #include <random>
 
 #include "point.h"
+#include "random.h"
 #include "common.h"
 
 namespace pp {
@@ -26,23 +27,37 @@ public:
         }
     }
 
-    /* sample around origo (0,0) */
-    inline Coord sample(rng_t &g) const { 
-        coord_t r = uniform_distribution(g);
-        coord_t t = uniform_distribution(g)*2*M_PI;
+    /* 
+     * sample around origo (0,0) 
+     * Rejection from the enclosing square: accepted points are uniform on the disk and 
+     * on average 4/pi pairs of uniforms are needed, without any sqrt or trigonometry.
+     */
+    inline Coord sample(RandomSource &g) const { 
+        coord_t x, y;
+        do {
+            x = 2*g.uniform() - 1;
+            y = 2*g.uniform() - 1;
+        } while (x*x + y*y >= 1);
+        return Coord(x*radius, y*radius);
+    }
+
+    /* sample around origo (0,0) using polar coordinates; same distribution as sample() */
+    inline Coord sample_polar(RandomSource &g) const { 
+        coord_t r = g.uniform();
+        coord_t t = g.uniform()*2*M_PI;
         coord_t x = sqrt(r) * cos(t);
         coord_t y = sqrt(r) * sin(t);
         return Coord(x*radius, y*radius);
     }
 
     /* give a randomly sampled point where origin is given by p */
-    inline Coord sample_around(rng_t& g, const Coord &p) { 
+    inline Coord sample_around(RandomSource &g, const Coord &p) { 
         auto deltaloc = sample(g);
         return deltaloc+p;
     }
     
     /* Randomly sample around p but wrap coords using U */
-    inline Coord sample_around_w(rng_t& g, const Coord &p, coord_t U) { 
+    inline Coord sample_around_w(RandomSource &g, const Coord &p, coord_t U) { 
         auto q = sample_around(g, p);
         q.wrap(U);
         return q;
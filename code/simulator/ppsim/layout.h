@@ -0,0 +1,155 @@
+#ifndef __LAYOUT_H_
+#define __LAYOUT_H_
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+#include "common.h"
+
+namespace pp {
+
+/*
+ * Cell layouts for PointSet: map a cell (x,y) of a row_length x row_length grid to a
+ * bucket index in [0, row_length^2).
+ *
+ * Each layout also orders neighbourhood stencils (lists of (dx,dy) offsets) so that a
+ * neighbourhood scan visits the buckets roughly in memory order.
+ */
+using stencil_t = std::vector<std::pair<int,int>>;
+
+/* Plain row-major layout: index = x + y*row_length */
+class RowMajorLayout {
+public:
+    void resize(uint_t rl) { row_length = rl; }
+
+    inline uint_t index(int x, int y) const { return x + y*row_length; }
+
+    /* consecutive x within a row are adjacent in memory, so iterate x innermost */
+    static void order_stencil(stencil_t &stencil) {
+        std::sort(stencil.begin(), stencil.end(), [](const std::pair<int,int> &a, const std::pair<int,int> &b) {
+            return a.second < b.second || (a.second == b.second && a.first < b.first);
+        });
+    }
+
+    static const char *name() { return "row-major"; }
+private:
+    uint_t row_length = 0;
+};
+
+/* Spread the lower 32 bits of x so that there is a zero bit between each of them */
+inline uint64_t spread_bits(uint64_t x) {
+    x &= 0xffffffffull;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+    x = (x | (x << 8))  & 0x00ff00ff00ff00ffull;
+    x = (x | (x << 4))  & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x << 2))  & 0x3333333333333333ull;
+    x = (x | (x << 1))  & 0x5555555555555555ull;
+    return x;
+}
+
+/* Z-order curve key */
+struct MortonCurve {
+    static uint64_t key(uint64_t x, uint64_t y, uint64_t /* n */) {
+        return spread_bits(x) | (spread_bits(y) << 1);
+    }
+    static const char *name() { return "morton"; }
+};
+
+/* Hilbert curve key on an n x n grid, n a power of two */
+struct HilbertCurve {
+    static uint64_t key(uint64_t x, uint64_t y, uint64_t n) {
+        uint64_t d = 0;
+        for(uint64_t s = n/2; s > 0; s /= 2) {
+            uint64_t rx = (x & s) > 0;
+            uint64_t ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            /* rotate the quadrant */
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = n-1 - x;
+                    y = n-1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+    static const char *name() { return "hilbert"; }
+};
+
+/*
+ * Cells ordered along a space-filling curve. The curve is laid over the smallest
+ * enclosing power-of-two grid and the cells are then ranked by their curve key,
+ * so there are no gaps even when row_length is not a power of two.
+ */
+template<typename C>
+class CurveLayout {
+public:
+    void resize(uint_t rl) {
+        row_length = rl;
+        uint64_t n = 1;
+        while (n < row_length) n *= 2;
+
+        std::vector<std::pair<uint64_t,uint32_t>> keys(row_length*row_length);
+        for(auto y = 0u; y<row_length; y++) {
+            for(auto x = 0u; x<row_length; x++) {
+                auto i = x + y*row_length;
+                keys[i] = std::make_pair(C::key(x, y, n), static_cast<uint32_t>(i));
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        table.resize(keys.size());
+        for(auto rank = 0u; rank<keys.size(); rank++) {
+            table[keys[rank].second] = rank;
+        }
+    }
+
+    inline uint_t index(int x, int y) const { return table[x + y*row_length]; }
+
+    /* visit the stencil along the same curve, which follows the memory order of the buckets */
+    static void order_stencil(stencil_t &stencil) {
+        int min = 0, max = 0;
+        for(const auto &o : stencil) {
+            min = std::min(min, std::min(o.first, o.second));
+            max = std::max(max, std::max(o.first, o.second));
+        }
+        uint64_t n = 1;
+        while (n < static_cast<uint64_t>(max - min + 1)) n *= 2;
+        std::sort(stencil.begin(), stencil.end(), [min, n](const std::pair<int,int> &a, const std::pair<int,int> &b) {
+            return C::key(a.first - min, a.second - min, n) < C::key(b.first - min, b.second - min, n);
+        });
+    }
+
+    static const char *name() { return C::name(); }
+private:
+    uint_t row_length = 0;
+    std::vector<uint32_t> table; // row-major cell index -> bucket index
+};
+
+using MortonLayout = CurveLayout<MortonCurve>;
+using HilbertLayout = CurveLayout<HilbertCurve>;
+
+/*
+ * Cell layout used by PointSet. Select it at compile time, e.g. -DCELL_LAYOUT=CELL_LAYOUT_MORTON
+ */
+#define CELL_LAYOUT_ROW_MAJOR 0
+#define CELL_LAYOUT_MORTON 1
+#define CELL_LAYOUT_HILBERT 2
+
+#ifndef CELL_LAYOUT
+#define CELL_LAYOUT CELL_LAYOUT_ROW_MAJOR
+#endif
+
+#if CELL_LAYOUT == CELL_LAYOUT_MORTON
+using cell_layout_t = MortonLayout;
+#elif CELL_LAYOUT == CELL_LAYOUT_HILBERT
+using cell_layout_t = HilbertLayout;
+#else
+using cell_layout_t = RowMajorLayout;
+#endif
+
+} // namespace
+
+#endif
@@ -42,6 +42,15 @@ public:
 
     uint_t max_entity_id() const { return *entities.rbegin(); }
     uint_t process_count() const { return trackers.size(); }
+
+    /* Largest distance at which any process looks for its inputs */
+    double max_input_radius() const {
+        double r = 0;
+        for(const auto &t : trackers) {
+            r = std::max(r, t->get_process().get_input_radius());
+        }
+        return r;
+    }
     void initialise(SimulationState *s) { // friend class Simulator will call this
         // initialise the trackers with a pointer to the simulation state
         for(const auto &p : trackers) {
@@ -54,6 +63,40 @@ public:
         initialised = true;
     }
 
+    /* 
+     * Copies of a model share its trackers, so each simulation needs its own clone: same 
+     * processes and dependencies, with fresh trackers that are not attached to any state.
+     */
+    Model clone() const {
+        Model m(*this);
+        for(auto &t : m.trackers) {
+            t = std::shared_ptr<Tracker>(t->fresh_copy());
+        }
+        return m;
+    }
+
+    /* Copy the tracked state of the model o, a clone of this, after its state was copied into ours */
+    void copy_state_from(const Model &o) {
+        for(auto i = 0u; i<trackers.size(); i++) {
+            trackers[i]->copy_state_from(*o.trackers.at(i));
+        }
+    }
+
+    /* Tracked state of the processes for checkpoints (see BasicSimulator::write_checkpoint) */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value<uint64_t>(trackers.size());
+        for(auto &t : trackers) {
+            t->write_checkpoint(w);
+        }
+    }
+
+    void read_checkpoint(CheckpointReader &r) {
+        r.expect<uint64_t>(trackers.size(), "processes");
+        for(auto &t : trackers) {
+            t->read_checkpoint(r);
+        }
+    }
+
     void update_entities(const IProcess &p) {
         for(auto i = 0u; i<p.get_input_count(); i++) {
             entities.insert(p.input(i));
@@ -77,6 +120,32 @@ public:
         }
     }
 
+    /* Interface used by BasicSimulator (see also StaticModel) */
+    const IProcess &get_process(uint_t rid) const { return trackers.at(rid)->get_process(); }
+    double propensity(uint_t rid) const { return trackers.at(rid)->propensity(); }
+
+    void update_propensities(std::vector<double> &ps) const {
+        for(auto i = 0u; i<trackers.size(); i++) {
+            ps[i] = trackers[i]->propensity();
+        }
+    }
+
+    void activate(uint_t rid, point_del_buf_t &removed, point_add_buf_t &added) {
+        trackers[rid]->activate(removed, added);
+    }
+
+    void notify_removal(Point &p) {
+        for(auto rid : dependencies[p.get_entity()]) {
+            trackers[rid]->notify_removal(p);
+        }
+    }
+
+    void notify_add(Point &p) {
+        for(auto rid : dependencies[p.get_entity()]) {
+            trackers[rid]->notify_add(p);
+        }
+    }
+
     std::vector<uint_t> &get_dependencies(uint_t entity) {
         return dependencies.at(entity);
     }
@@ -90,7 +159,7 @@ public:
     }
 
 private:
-    bool initialised;
+    bool initialised = false;
     entities_t entities; // list of entities
     dependency_list_t dependencies; // entity -> process dependency mapping
     trackers_t trackers; // give the tracker for ith process
@@ -10,25 +10,60 @@ namespace pp {
  * For safety reasons, only PointSet can allocate these. */
 class Point {
 public:
-    const coord_t& operator[](std::size_t i) const { return coord[i]; }
+    inline coord_t operator[](std::size_t i) const { return coord[i]; }
     inline uint_t get_entity() const { return entity; }
+#if COMPACT_POINTS
+    inline Coord get_coord() const { return Coord(coord_t(coord[0]), coord_t(coord[1])); }
+    inline size_t hash() const { return compute_hash(); }
+#else
     inline const Coord &get_coord() const { return coord; }
-    inline double torus_squared_distance(const Point &q, double U) const { return coord.torus_squared_distance(q.coord, U); }
     inline size_t hash() const { return hash_value; }
+#endif
+
+    /* computed in coord_t precision also for compact points */
+    inline double torus_squared_distance(const Point &q, double U) const { 
+        coord_t sum = 0;
+        for(int i = 0; i<2; i++) {
+            coord_t t = std::abs(coord_t(coord[i]) - coord_t(q.coord[i]));
+            coord_t s = std::min(t, U-t);
+            sum += s*s;
+        }
+        return sum;
+    }
 protected:
     friend class PointSet;
-    friend class boost::object_pool<Point>;
+    friend class ObjectPool<Point>;
     
-    Point(coord_t x, coord_t y, uint_t e) : entity(e), coord(Coord(x,y)) { 
-        hash_value = coord.hash();
-        boost::hash_combine(hash_value, std::hash<uint_t>{}(entity));
+    Point(coord_t x, coord_t y, uint_t e) : coord(std::array<point_coord_t,2>{{point_coord_t(x), point_coord_t(y)}}), entity(e) { 
+#if !COMPACT_POINTS
+        hash_value = compute_hash();
+#endif
+    }
+
+    inline size_t compute_hash() const {
+        size_t value = get_coord().hash();
+        boost::hash_combine(value, std::hash<uint_t>{}(get_entity()));
+        return value;
     }
 
-    uint_t entity;
-    Coord coord;
-    bucket_t::iterator it;
-    size_t bucket;
+    /* Single precision rounding may push a coordinate onto the upper boundary; pull it back */
+    inline void fit_into(coord_t U) {
+#if COMPACT_POINTS
+        auto values = coord.get_values();
+        for(auto &v : values) {
+            if (v >= U) v = std::nextafter(point_coord_t(U), point_coord_t(0));
+        }
+        coord = DCoord<point_coord_t,2>(values);
+#endif
+    }
+
+    DCoord<point_coord_t,2> coord;
+    point_entity_t entity;
+    point_index_t slot; // index of the point within its bucket
+    point_index_t bucket;
+#if !COMPACT_POINTS
     size_t hash_value;
+#endif
 };
 
 std::ostream &operator<< (std::ostream &os, const pp::Point &p) {
@@ -5,30 +5,48 @@
 #include <stdexcept>
 #include <sstream>
 
-#include "accumulator.h"
+#include "sumtree.h"
+#include "layout.h"
+#include "quadtree.h"
 #include "point.h"
 #include "common.h"
+#include "checkpoint.h"
 
 #ifndef __POOL_HASHSET_H_
 #define __POOL_HASHSET_H_
 
-namespace pp {
+/*
+ * With USE_GHOST_CELLS=1, Simulator builds its point sets with ghost cells covering the largest
+ * input radius of the model. Off by default: it changes the order of neighbours (and so the
+ * trajectories) and makes removals near the boundary search the mirrored cells.
+ */
+#ifndef USE_GHOST_CELLS
+#define USE_GHOST_CELLS 0
+#endif
 
-static boost::object_pool<Point> point_pool;
+namespace pp {
 
 class PointSet {
 public:
-    PointSet(coord_t U_, coord_t bw) : U(U_), bucket_width(bw) {
+    /* 
+     * Points live in a grid of cells of width (about) bw over the UxU torus. 
+     * If ghost_radius > 0, cells within ghost_radius of the boundary are mirrored into a ring of 
+     * ghost cells around the grid so that queries up to that distance need no wrapping.
+     */
+    PointSet(coord_t U_, coord_t bw, coord_t ghost_radius = 0) : max_occupancy(0), U(U_), bucket_width(bw) {
         row_length = ceil(U/bucket_width);
         bucket_count = row_length * row_length;
         norm_coord = row_length/U;
+        layout.resize(row_length);
         buckets.resize(bucket_count);
         for(auto i = 0u; i<bucket_count; i++) {
             buckets[i] = bucket_t();
         }
 
-        auto depth = log2(bucket_count);
-        accumulator = std::unique_ptr<Accumulator<long int>>(new Accumulator<long int>(bucket_count, depth));
+        /* one leaf per bucket so that the accumulator gives exact per-bucket counts */
+        accumulator = std::unique_ptr<accumulator_t<long int>>(new accumulator_t<long int>(bucket_count));
+
+        init_ghosts(int(ceil(ghost_radius * norm_coord)));
     }
 
     ~PointSet() {
@@ -36,19 +54,22 @@ public:
     }
 
     uint_t get_count() const { 
-        return accumulator->get_nodes()[0]; 
+        return accumulator->total(); 
     }
 
     /* Allocate a new point but do NOT yet add it into the data structure */
     inline Point *new_point(coord_t x, coord_t y, uint_t e) {
-        //auto p = new Point(x,y,e); 
-        auto p = point_pool.construct(x,y,e);
+        auto p = pool.construct(x,y,e);
         DMSG("PointSet::new_point(" << x << ", " << y << ", " << e << ") = " << p);
         assert(x >= 0 && x < U && "x-coord out of bounds; is your domain size too small?");
         assert(y >= 0 && y < U && "x-coord out of bounds; is your domain size too small?");
         assert(p->get_entity() == e);
+#if COMPACT_POINTS
+        p->fit_into(U);
+#else
         assert((*p)[0] == x);
         assert((*p)[1] == y);
+#endif
         p->bucket = get_bucket(p);
         return p;
     }
@@ -58,22 +79,31 @@ public:
         assert(contains(p));
         remove(p);
         assert(!contains(p));
-        point_pool.destroy(p); // This will invalidate the pointer p!!!
+        pool.destroy(p); // This will invalidate the pointer p!!!
     }
 
     bool contains(const Point* p) const {
         assert(p != nullptr);
         auto b = p->bucket; 
-        auto it = std::find(buckets[b].begin(), buckets[b].end(), p); 
-        return (it != buckets[b].end());
+        return p->slot < buckets[b].size() && buckets[b][p->slot] == p;
     }
 
+    /*
+     * Rings of cells around the focal cell that can hold points within distance: the distance
+     * in cell widths (U/row_length, at most bw), rounded up. It used to be rounded to the
+     * nearest multiple of bw, which missed neighbours up to half a cell further out (e.g. at
+     * radius 1.2 with unit cells), so trajectories differ from those of such versions.
+     */
+    int query_rings(double distance) const { return int(ceil(distance * norm_coord)); }
+
     void get_within(const Point *p, double distance, point_query_t &buffer) const {
         DMSG("get_within(" << *p << ", " << distance);
-        auto cdistance = int((distance / bucket_width + 0.5));
+        auto cdistance = query_rings(distance);
         DMSG("cdistance="<<cdistance);
         if (2*cdistance + 1 >= row_length) {
             get_within_bruteforce(p, distance, buffer);
+        } else if (cdistance <= ghost_width) {
+            get_within_ghosts(p, distance, cdistance, buffer);
         } else {
             get_within_clever(p, distance, cdistance, buffer);
 #if DEBUG
@@ -102,48 +132,240 @@ public:
     }
 
     Point *get_nth(int n) {
-        assert(get_count()>=n);
-        auto r = accumulator->find_start_location(n);
-        auto start = r.first;
-        auto remaining = r.second;
-        DMSG("finding " << n << "th: start at " << start << " and skip " << remaining);
-
-        for(auto i = start; i<buckets.size(); i++) {
-            for(auto p : buckets[i]) {
-                if (remaining == 0) return p;
-                remaining -= 1;
-            }
+        assert(n >= 0 && n < get_count());
+        /* Each bucket has its own leaf, so the accumulator gives the exact bucket and 
+         * the rest is a direct index into the bucket array. */
+        auto r = accumulator->find_start_location(n+1);
+        auto b = r.first;
+        auto index = r.second - 1;
+        DMSG("finding " << n << "th: bucket " << b << " index " << index);
+
+        if (b >= buckets.size() || index < 0 || index >= buckets[b].size()) {
+            /* Something went wrong! */
+            std::stringstream s;
+            s <<"Could not find nth point";
+            s << "in get_nth(" << n << ")" << " bucket = " << b << " index = " << index;
+            s << " count=" << get_count();
+            throw std::runtime_error(s.str());
         }
-
-        /* Something went wrong! */
-        DMSG("remaining " << remaining);
-        std::stringstream s;
-        s <<"Could not find nth point";
-        s << "in get_nth(" << n << ")" << " remaining = " << remaining;
-        s << " count=" << get_count();
-        throw std::runtime_error(s.str());
+        return buckets[b][index];
     }
 
     void add(Point *p) {
         DMSG("PointSet::add(" << p << ") which is " << *p);
         assert(!contains(p) && "Adding a point that already has been added!");
         auto b = p->bucket; 
-        buckets[b].push_back(p); // list
-        p->it = std::prev(buckets[b].end());
-        assert(p == *p->it);
+        p->slot = buckets[b].size();
+        buckets[b].push_back(p);
+        assert(p == buckets[b][p->slot]);
 
         accumulator->increment(b,1);
+        if (ghost_width > 0) {
+            for_each_mirror(p, [this, p](uint_t g) { ghosts[g].push_back(p); });
+        }
+        if (max_occupancy > 0) {
+            if (trees[b]) {
+                trees[b]->insert(p);
+            } else if (buckets[b].size() > max_occupancy) {
+                build_tree(b);
+            }
+        }
         assert(contains(p) && "A point that was just added should be found!");
     }
 
+    /* 
+     * Use an adaptive index for crowded cells: once a cell holds more than n points, 
+     * distance queries into it go through a quadtree whose leaves hold at most n points. 
+     * n = 0 turns the adaptive index off and the set is a plain uniform grid.
+     */
+    void set_max_occupancy(uint_t n) {
+        max_occupancy = n;
+        trees.clear();
+        if (max_occupancy == 0) return;
+        trees.resize(bucket_count);
+        for(auto b = 0u; b<bucket_count; b++) {
+            if (buckets[b].size() > max_occupancy) {
+                build_tree(b);
+            }
+        }
+    }
+
+    uint_t get_max_occupancy() const { return max_occupancy; }
+
+    /*
+     * Make this empty set a copy of o, which must have the same geometry. Each point is copied
+     * into the same bucket and slot, so the copy of a point q of o is corresponding(q), and the
+     * ghost cells and quadtrees are copied as they are instead of being rebuilt.
+     */
+    void copy_from(const PointSet &o) {
+        if (get_count() > 0 || bucket_count != o.bucket_count || ghosts.size() != o.ghosts.size()) {
+            throw std::runtime_error("PointSet::copy_from: the target must be empty and have the same geometry");
+        }
+        for(auto b = 0u; b<bucket_count; b++) {
+            buckets[b].reserve(o.buckets[b].size());
+            for(auto q : o.buckets[b]) {
+                buckets[b].push_back(pool.construct(*q));
+            }
+            if (!buckets[b].empty()) {
+                accumulator->increment(b, buckets[b].size());
+            }
+        }
+        for(auto g = 0u; g<ghosts.size(); g++) {
+            ghosts[g].clear();
+            for(auto q : o.ghosts[g]) {
+                ghosts[g].push_back(corresponding(q));
+            }
+        }
+        max_occupancy = o.max_occupancy;
+        trees.clear();
+        trees.resize(o.trees.size());
+        for(auto b = 0u; b<o.trees.size(); b++) {
+            if (o.trees[b]) {
+                trees[b] = std::unique_ptr<CellTree>(new CellTree(*o.trees[b]));
+                trees[b]->remap_points([this](const Point *q) { return corresponding(q); });
+            }
+        }
+    }
+
+    /*
+     * The points in bucket and slot order, and the ghost cells and quadtrees as they are: their
+     * order decides the order of query results and thus of the tracked configurations.
+     */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value(bucket_count);
+        w.value<uint64_t>(ghosts.size());
+        w.value(max_occupancy);
+        for(auto &b : buckets) {
+            w.value<uint64_t>(b.size());
+            for(auto p : b) {
+                w.value<coord_t>((*p)[0]);
+                w.value<coord_t>((*p)[1]);
+            }
+        }
+        for(auto &g : ghosts) {
+            w.value<uint64_t>(g.size());
+            for(auto p : g) write_ref(w, p);
+        }
+        for(auto b = 0u; b<trees.size(); b++) {
+            w.value<char>(bool(trees[b]));
+            if (trees[b]) {
+                /* the points of a tree are those of its bucket */
+                trees[b]->write_checkpoint(w, [&w](const Point *p) { w.value<uint32_t>(p->slot); });
+            }
+        }
+    }
+
+    /* Restore the points of entity e into this empty set (see write_checkpoint) */
+    void read_checkpoint(CheckpointReader &r, uint_t e) {
+        if (get_count() > 0) {
+            throw std::runtime_error("PointSet::read_checkpoint: the set must be empty");
+        }
+        r.expect(bucket_count, "cell grid");
+        r.expect<uint64_t>(ghosts.size(), "ghost cells");
+        max_occupancy = r.value<uint_t>();
+        for(auto b = 0u; b<bucket_count; b++) {
+            buckets[b].resize(r.value<uint64_t>());
+            for(auto i = 0u; i<buckets[b].size(); i++) {
+                auto x = r.value<coord_t>();
+                auto y = r.value<coord_t>();
+                auto p = pool.construct(x, y, e);
+                p->bucket = b;
+                p->slot = i;
+                buckets[b][i] = p;
+                if (get_bucket(p) != b) throw std::runtime_error("Checkpoint has a point outside its cell");
+            }
+            if (!buckets[b].empty()) {
+                accumulator->increment(b, buckets[b].size());
+            }
+        }
+        for(auto &g : ghosts) {
+            g.resize(r.value<uint64_t>());
+            for(auto &p : g) p = read_ref(r);
+        }
+        trees.clear();
+        trees.resize(max_occupancy > 0 ? bucket_count : 0);
+        for(auto b = 0u; b<trees.size(); b++) {
+            if (r.value<char>()) {
+                trees[b] = std::unique_ptr<CellTree>(new CellTree(0, 0, 0, max_occupancy));
+                trees[b]->read_checkpoint(r, [&r, b, this]() { return point_at(b, r.value<uint32_t>()); });
+            }
+        }
+    }
+
+    /* A point written as its bucket and slot */
+    void write_ref(CheckpointWriter &w, const Point *p) const {
+        w.value<uint32_t>(p->bucket);
+        w.value<uint32_t>(p->slot);
+    }
+
+    Point *read_ref(CheckpointReader &r) const {
+        auto b = r.value<uint32_t>();
+        return point_at(b, r.value<uint32_t>());
+    }
+
+    /* Point of this set in the bucket and slot of q, the copy of q after copy_from */
+    inline Point *corresponding(const Point *q) const {
+        return buckets[q->bucket][q->slot];
+    }
+
 
 private:
     friend class SimulationState;
     /* implementation details */
     void remove(Point *p) {
         auto b = p->bucket; 
-        buckets[b].erase(p->it);
-        accumulator->increment(b,-1);        
+        /* swap-remove: the last point of the bucket takes over the slot of p */
+        auto last = buckets[b].back();
+        buckets[b][p->slot] = last;
+        last->slot = p->slot;
+        buckets[b].pop_back();
+        accumulator->increment(b,-1);
+        if (ghost_width > 0) {
+            for_each_mirror(p, [this, p](uint_t g) {
+                auto &ghost = ghosts[g];
+                auto it = std::find(ghost.begin(), ghost.end(), p);
+                assert(it != ghost.end() && "A mirrored point was not found in its ghost cell");
+                *it = ghost.back();
+                ghost.pop_back();
+            });
+        }
+        if (max_occupancy > 0 && trees[b]) {
+            if (buckets[b].size() <= max_occupancy/2) {
+                trees[b].reset();
+            } else {
+                trees[b]->remove(p);
+            }
+        }
+    }
+
+    Point *point_at(uint_t b, uint_t slot) const {
+        if (b >= bucket_count || slot >= buckets[b].size()) {
+            throw std::runtime_error("Checkpoint refers to a point that does not exist");
+        }
+        return buckets[b][slot];
+    }
+
+    void build_tree(uint_t b) {
+        assert(!buckets[b].empty());
+        auto cs = get_bucket_coords(buckets[b].front());
+        auto width = U/row_length;
+        trees[b] = std::unique_ptr<CellTree>(new CellTree(cs.first*width, cs.second*width, width, max_occupancy));
+        for(auto p : buckets[b]) {
+            trees[b]->insert(p);
+        }
+    }
+
+    /* Points of bucket b within the distance from p */
+    inline void scan_bucket(uint_t b, const Point *p, coord_t dsquared, point_query_t &buffer) const {
+        if (max_occupancy > 0 && trees[b]) {
+            trees[b]->get_within(p, dsquared, U, buffer);
+            return;
+        }
+        for(const auto &q : buckets[b]) {
+            if (p->torus_squared_distance(*q, U) <= dsquared && !(p == q)) {
+                buffer.push_back(q);
+            }
+        }
     }
 
     inline std::pair<int,int> get_bucket_coords(const Point *p) const {
@@ -163,7 +385,24 @@ private:
     }
 
     inline uint_t get_bucket_index(std::pair<int,int> cs) const {
-        return cs.first + cs.second*row_length;
+        return layout.index(cs.first, cs.second);
+    }
+
+    /* (dx,dy) offsets of the cells within cdistance, in the visiting order preferred by the layout */
+    const stencil_t &get_stencil(int cdistance) const {
+        if (cdistance >= stencils.size()) {
+            stencils.resize(cdistance+1);
+        }
+        auto &stencil = stencils[cdistance];
+        if (stencil.empty()) {
+            for(auto dx = -cdistance; dx <= cdistance; dx++) {
+                for(auto dy = -cdistance; dy <= cdistance; dy++) {
+                    stencil.push_back(std::make_pair(dx, dy));
+                }
+            }
+            cell_layout_t::order_stencil(stencil);
+        }
+        return stencil;
     }
 
     inline uint_t get_bucket(const Point* p) const {
@@ -176,12 +415,85 @@ private:
         auto cs = get_bucket_coords(p); /* bucket (x,y) which contains the focal point p */
         auto x = cs.first;
         auto y = cs.second;
-        for(auto dx = -cdistance; dx <= cdistance; dx++) {
-            for(auto dy = -cdistance; dy <= cdistance; dy++) {
-                auto ws = wrap_bucket_coords(x+dx, y+dy);
-                auto b = get_bucket_index(ws);
-                for(const auto &q : buckets[b]) {
-                    if (p->torus_squared_distance(*q, U) <= dsquared && !(p == q)) {
+        for(const auto &d : get_stencil(cdistance)) {
+            auto ws = wrap_bucket_coords(x+d.first, y+d.second);
+            auto b = get_bucket_index(ws);
+            scan_bucket(b, p, dsquared, buffer);
+        }
+    }
+
+    /*
+     * Ghost cells. The padded grid has ghost_width extra cells on each side; cell_table maps a 
+     * padded cell either to its home bucket (< bucket_count) or to bucket_count + ghost index. 
+     * Ghost cells hold pointers to the mirrored points and the shift that takes them next to the grid.
+     */
+    void init_ghosts(int g) {
+        /* a cell must not be mirrored twice on the same side */
+        if (g <= 0 || 2*g + 1 >= row_length) {
+            ghost_width = 0;
+            return;
+        }
+        ghost_width = g;
+        padded_row_length = row_length + 2*g;
+        cell_table.resize(padded_row_length*padded_row_length);
+        for(auto py = 0u; py<padded_row_length; py++) {
+            for(auto px = 0u; px<padded_row_length; px++) {
+                int x = int(px) - g, y = int(py) - g;
+                auto &cell = cell_table[px + py*padded_row_length];
+                if (x >= 0 && x < row_length && y >= 0 && y < row_length) {
+                    cell = layout.index(x, y);
+                } else {
+                    cell = bucket_count + ghost_shifts.size();
+                    ghost_shifts.push_back(std::make_pair((x < 0) ? -U : ((x >= row_length) ? U : 0), 
+                                                          (y < 0) ? -U : ((y >= row_length) ? U : 0)));
+                }
+            }
+        }
+        ghosts.resize(ghost_shifts.size());
+    }
+
+    /* Call f with the index of each ghost cell that mirrors the cell of p */
+    template<typename F>
+    inline void for_each_mirror(const Point *p, F f) const {
+        auto cs = get_bucket_coords(p);
+        int x = cs.first, y = cs.second, g = ghost_width, rl = row_length;
+        if (x >= g && x < rl - g && y >= g && y < rl - g) return; // interior cell
+        for(int kx = -1; kx <= 1; kx++) {
+            for(int ky = -1; ky <= 1; ky++) {
+                if (kx == 0 && ky == 0) continue;
+                int px = x + g + kx*rl, py = y + g + ky*rl;
+                if (px < 0 || px >= padded_row_length || py < 0 || py >= padded_row_length) continue;
+                f(cell_table[px + py*padded_row_length] - bucket_count);
+            }
+        }
+    }
+
+    /* Query within ghost_width cells: plain Euclidean distances on contiguous padded cells */
+    void get_within_ghosts(const Point *p, coord_t distance, int cdistance, point_query_t &buffer) const {
+        auto dsquared = distance*distance;
+        auto cs = get_bucket_coords(p);
+        auto px = cs.first + ghost_width;
+        auto py = cs.second + ghost_width;
+        auto x = (*p)[0], y = (*p)[1];
+        for(const auto &d : get_stencil(cdistance)) {
+            auto cell = cell_table[(px+d.first) + (py+d.second)*padded_row_length];
+            if (cell < bucket_count) {
+                if (max_occupancy > 0 && trees[cell]) {
+                    trees[cell]->get_within(p, dsquared, U, buffer);
+                    continue;
+                }
+                for(const auto &q : buckets[cell]) {
+                    auto dx = (*q)[0] - x, dy = (*q)[1] - y;
+                    if (dx*dx + dy*dy <= dsquared && !(p == q)) {
+                        buffer.push_back(q);
+                    }
+                }
+            } else {
+                auto g = cell - bucket_count;
+                auto sx = ghost_shifts[g].first - x, sy = ghost_shifts[g].second - y;
+                for(const auto &q : ghosts[g]) {
+                    auto dx = (*q)[0] + sx, dy = (*q)[1] + sy;
+                    if (dx*dx + dy*dy <= dsquared && !(p == q)) {
                         buffer.push_back(q);
                     }
                 }
@@ -200,8 +512,18 @@ private:
         }
     }
 
+    ObjectPool<Point> pool; // storage of the points of this set
     bucket_list_t buckets;
-    std::unique_ptr<Accumulator<long int>> accumulator;
+    std::unique_ptr<accumulator_t<long int>> accumulator;
+    cell_layout_t layout; // maps cell coordinates to bucket indices
+    mutable std::vector<stencil_t> stencils; // neighbourhood stencils by cell distance
+    uint_t max_occupancy; // cells with more points than this get a quadtree (0 = never)
+    std::vector<std::unique_ptr<CellTree>> trees; // quadtrees of crowded cells, indexed by bucket
+    int ghost_width = 0; // width of the ghost cell ring in cells (0 = no ghost cells)
+    int padded_row_length = 0; // row_length + 2*ghost_width
+    std::vector<uint32_t> cell_table; // padded cell -> bucket index or bucket_count + ghost index
+    bucket_list_t ghosts; // mirrored points of the ghost cells
+    std::vector<std::pair<coord_t,coord_t>> ghost_shifts; // coordinate shift of each ghost cell
 
     //uint_t count;
     coord_t norm_coord;
@@ -2,7 +2,16 @@
 #define __PP_H_
 
 #include "writers.h"
+#include "async_writer.h"
+#include "binary_snapshot.h"
+#include "event_log.h"
+#include "gzip_stream.h"
+#include "results_file.h"
+#include "thread_pool.h"
+#include "statistics.h"
+#include "checkpoint.h"
 #include "simulator.h"
+#include "splitting.h"
 #include "process_definitions.h"
 
 #endif
@@ -0,0 +1,236 @@
+#ifndef __QUADTREE_H_
+#define __QUADTREE_H_
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "common.h"
+#include "point.h"
+#include "checkpoint.h"
+
+namespace pp {
+
+/*
+ * Quadtree over a single square cell of a PointSet.
+ *
+ * PointSet builds one of these for a cell once the cell holds more than 'capacity' points,
+ * so that distance queries into crowded cells only look at leaves that can intersect the
+ * query disk. Leaves hold at most 'capacity' points unless they are at the maximum depth.
+ * Nodes are stored in a flat vector; children of a node are four consecutive entries.
+ */
+class CellTree {
+public:
+    static constexpr int MAX_DEPTH = 16;
+
+    CellTree(coord_t x0, coord_t y0, coord_t width, uint_t cap) : capacity(cap) {
+        nodes.push_back(Node(x0, y0, width, 0));
+    }
+
+    void insert(Point *p) {
+        auto n = find_leaf(p);
+        nodes[n].points.push_back(p);
+        update_counts(p, 1);
+        if (nodes[n].points.size() > capacity && nodes[n].depth < MAX_DEPTH) {
+            split(n);
+        }
+    }
+
+    void remove(Point *p) {
+        auto n = find_leaf(p);
+        auto &ps = nodes[n].points;
+        auto it = std::find(ps.begin(), ps.end(), p);
+        assert(it != ps.end() && "CellTree::remove: point not found in its leaf");
+        *it = ps.back();
+        ps.pop_back();
+        update_counts(p, -1);
+        collapse_along(p);
+    }
+
+    uint_t size() const { return nodes[0].count; }
+
+    /* The node structure as it is, with each point written by ref(p) and read back by point(r) */
+    template<typename F>
+    void write_checkpoint(CheckpointWriter &w, F ref) const {
+        w.value<uint64_t>(nodes.size());
+        for(auto &n : nodes) {
+            w.value(n.x0);
+            w.value(n.y0);
+            w.value(n.width);
+            w.value(n.depth);
+            w.value(n.first_child);
+            w.value(n.count);
+            w.value<uint64_t>(n.points.size());
+            for(auto p : n.points) ref(p);
+        }
+        w.vector(free_blocks);
+    }
+
+    template<typename F>
+    void read_checkpoint(CheckpointReader &r, F point) {
+        nodes.clear();
+        auto size = r.value<uint64_t>();
+        for(auto i = 0u; i<size; i++) {
+            auto x0 = r.value<coord_t>();
+            auto y0 = r.value<coord_t>();
+            auto width = r.value<coord_t>();
+            Node n(x0, y0, width, r.value<int>());
+            n.first_child = r.value<long>();
+            n.count = r.value<uint_t>();
+            n.points.resize(r.value<uint64_t>());
+            for(auto &p : n.points) p = point();
+            nodes.push_back(std::move(n));
+        }
+        free_blocks = r.vector<long>();
+    }
+
+    /* Replace each point q by f(q), e.g. to move a copied tree over to the points of a copied set */
+    template<typename F>
+    void remap_points(F f) {
+        for(auto &n : nodes) {
+            for(auto &p : n.points) p = f(p);
+        }
+    }
+
+    /* Add points within the distance (sqrt of dsquared) of p (on a torus of size U) into buffer */
+    void get_within(const Point *p, coord_t dsquared, coord_t U, point_query_t &buffer) const {
+        get_within(0, p, dsquared, U, buffer);
+    }
+
+private:
+    struct Node {
+        Node(coord_t x, coord_t y, coord_t w, int d) : x0(x), y0(y), width(w), depth(d), first_child(-1), count(0) {}
+        coord_t x0, y0, width;
+        int depth;
+        long first_child; // index of the first of the four children or -1 for leaves
+        uint_t count; // points in the subtree
+        std::vector<Point*> points; // only used by leaves
+
+        inline bool is_leaf() const { return first_child < 0; }
+        inline int quadrant(const Point *p) const {
+            return ((*p)[0] >= x0 + width/2) + 2*((*p)[1] >= y0 + width/2);
+        }
+    };
+
+    long find_leaf(const Point *p) const {
+        long n = 0;
+        while (!nodes[n].is_leaf()) {
+            n = nodes[n].first_child + nodes[n].quadrant(p);
+        }
+        return n;
+    }
+
+    void update_counts(const Point *p, int delta) {
+        long n = 0;
+        while (true) {
+            nodes[n].count += delta;
+            if (nodes[n].is_leaf()) break;
+            n = nodes[n].first_child + nodes[n].quadrant(p);
+        }
+    }
+
+    void split(long n) {
+        long first;
+        if (!free_blocks.empty()) {
+            first = free_blocks.back();
+            free_blocks.pop_back();
+        } else {
+            first = nodes.size();
+            nodes.resize(nodes.size() + 4, Node(0, 0, 0, 0));
+        }
+        auto half = nodes[n].width/2;
+        for(int q = 0; q<4; q++) {
+            nodes[first+q] = Node(nodes[n].x0 + (q % 2)*half, nodes[n].y0 + (q / 2)*half, half, nodes[n].depth+1);
+        }
+        nodes[n].first_child = first;
+
+        auto points = std::move(nodes[n].points);
+        nodes[n].points.clear();
+        for(auto p : points) {
+            auto &child = nodes[first + nodes[n].quadrant(p)];
+            child.points.push_back(p);
+            child.count++;
+        }
+        /* all points may have landed in the same child */
+        for(int q = 0; q<4; q++) {
+            if (nodes[first+q].points.size() > capacity && nodes[first+q].depth < MAX_DEPTH) {
+                split(first+q);
+            }
+        }
+    }
+
+    /* Merge subtrees on the path of p that no longer need splitting */
+    void collapse_along(const Point *p) {
+        long n = 0;
+        while (!nodes[n].is_leaf()) {
+            if (nodes[n].count <= capacity/2) {
+                collapse(n);
+                return;
+            }
+            n = nodes[n].first_child + nodes[n].quadrant(p);
+        }
+    }
+
+    void collapse(long n) {
+        std::vector<Point*> points;
+        gather(n, points);
+        release(n);
+        nodes[n].first_child = -1;
+        nodes[n].points = std::move(points);
+    }
+
+    void gather(long n, std::vector<Point*> &points) const {
+        if (nodes[n].is_leaf()) {
+            points.insert(points.end(), nodes[n].points.begin(), nodes[n].points.end());
+            return;
+        }
+        for(int q = 0; q<4; q++) gather(nodes[n].first_child + q, points);
+    }
+
+    void release(long n) {
+        if (nodes[n].is_leaf()) return;
+        auto first = nodes[n].first_child;
+        for(int q = 0; q<4; q++) {
+            release(first + q);
+            nodes[first + q].points.clear();
+            nodes[first + q].first_child = -1;
+        }
+        free_blocks.push_back(first);
+    }
+
+    /* Squared torus distance from coordinate a to the interval [lo, lo+w] */
+    static inline coord_t interval_distance(coord_t a, coord_t lo, coord_t w, coord_t U) {
+        coord_t d = 0;
+        if (a < lo) d = lo - a;
+        else if (a > lo + w) d = a - (lo + w);
+        return std::min(d, std::max<coord_t>(0, U - w - d));
+    }
+
+    void get_within(long n, const Point *p, coord_t dsquared, coord_t U, point_query_t &buffer) const {
+        const auto &node = nodes[n];
+        if (node.count == 0) return;
+        auto dx = interval_distance((*p)[0], node.x0, node.width, U);
+        auto dy = interval_distance((*p)[1], node.y0, node.width, U);
+        if (dx*dx + dy*dy > dsquared) return;
+
+        if (node.is_leaf()) {
+            for(auto q : node.points) {
+                if (p->torus_squared_distance(*q, U) <= dsquared && !(p == q)) {
+                    buffer.push_back(q);
+                }
+            }
+            return;
+        }
+        for(int q = 0; q<4; q++) {
+            get_within(node.first_child + q, p, dsquared, U, buffer);
+        }
+    }
+
+    const uint_t capacity;
+    std::vector<Node> nodes;
+    std::vector<long> free_blocks; // released groups of four children
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef __RANDOM_H_
+#define __RANDOM_H_
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "common.h"
+#include "checkpoint.h"
+
+namespace pp {
+
+/*
+ * Exponential ziggurat tables (Marsaglia & Tsang) with 256 layers.
+ *
+ * Layer i covers [0, x[i]] between heights f[i] = exp(-x[i]) and f[i+1]. Layer 0 is the base
+ * rectangle [0, R] x [0, exp(-R)] together with the tail beyond R, stretched to the same area V.
+ */
+struct ExponentialZiggurat {
+    static constexpr int LAYERS = 256;
+    static constexpr double R = 7.69711747013104972;
+    static constexpr double V = 3.9496598225815571993e-3;
+
+    double x[LAYERS+1];
+    double f[LAYERS+1];
+
+    ExponentialZiggurat() {
+        x[0] = V / exp(-R);
+        x[1] = R;
+        for(int i = 1; i<LAYERS-1; i++) {
+            x[i+1] = -log(V/x[i] + exp(-x[i]));
+        }
+        x[LAYERS] = 0;
+        for(int i = 0; i<=LAYERS; i++) {
+            f[i] = exp(-x[i]);
+        }
+    }
+
+    static const ExponentialZiggurat &get() {
+        static const ExponentialZiggurat tables;
+        return tables;
+    }
+};
+
+/*
+ * Identifies an independent random stream. (case_id, replicate) select a PCG stream (a distinct
+ * increment of the LCG); (thread, tile) select a block of 2^64 draws within that stream, so
+ * sub-streams do not overlap as long as none of them uses more than 2^64 values.
+ */
+struct StreamId {
+    uint32_t case_id = 0;
+    uint32_t replicate = 0;
+    uint32_t thread = 0;
+    uint32_t tile = 0;
+
+    StreamId() {}
+    StreamId(uint32_t c, uint32_t r, uint32_t th = 0, uint32_t ti = 0) : case_id(c), replicate(r), thread(th), tile(ti) {}
+
+    inline uint64_t stream() const { return (uint64_t(case_id) << 32) | replicate; }
+    inline uint64_t block() const { return (uint64_t(thread) << 32) | tile; }
+};
+
+inline std::ostream &operator<< (std::ostream &os, const StreamId &id) {
+    return os << "StreamId(case=" << id.case_id << ", replicate=" << id.replicate 
+              << ", thread=" << id.thread << ", tile=" << id.tile << ")";
+}
+
+/*
+ * Random number front end of a simulation.
+ *
+ * Uniform doubles are produced a block at a time: the generator fills a block of raw 64-bit
+ * values and a separate (vectorisable) loop converts them to [0,1) with 53 bits of precision.
+ * Exponential variates use a ziggurat, so almost all of them need neither log() nor exp().
+ */
+class RandomSource {
+public:
+    static constexpr unsigned int BLOCK = 256;
+
+    RandomSource() : next(BLOCK), zig(&ExponentialZiggurat::get()) {}
+
+    /* Reseeding discards the buffered values, so a seed always gives the same stream */
+    template<typename T>
+    void seed(T &s) {
+        engine.seed(s);
+        next = BLOCK;
+    }
+
+    /* 
+     * Select the stream id of the generator seeded with the master seed. All simulations of 
+     * an ensemble share the master seed and differ by their id.
+     */
+    void seed_stream(uint64_t master_seed, const StreamId &id) {
+#if USE_PCG
+        engine.seed(pcg_extras::pcg128_t(master_seed), pcg_extras::pcg128_t(id.stream()));
+        engine.advance(pcg_extras::pcg128_t(id.block()) << 64);
+#else
+        std::seed_seq seq { uint32_t(master_seed), uint32_t(master_seed >> 32), id.case_id, id.replicate, id.thread, id.tile };
+        engine.seed(seq);
+#endif
+        next = BLOCK;
+    }
+
+    /* Random value from range [0,1) */
+    inline double uniform() {
+        if (next == BLOCK) refill();
+        return block[next++];
+    }
+
+    /* Exponential variate with rate 1 */
+    double exponential() {
+        while (true) {
+            auto bits = draw_bits();
+            auto i = bits & 0xff;
+            auto z = to_unit(bits) * zig->x[i];
+            if (z < zig->x[i+1]) return z; // inside the rectangle under the curve
+            if (i == 0) return ExponentialZiggurat::R + exponential(); // memoryless tail
+            /* wedge */
+            if (zig->f[i] + uniform()*(zig->f[i+1] - zig->f[i]) < exp(-z)) return z;
+        }
+    }
+
+    inline rng_t &get_engine() { return engine; }
+
+    /* Engine state and the current block, so that a restored source continues the same sequence */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value(engine);
+        w.value(next);
+        w.vector(std::vector<uint64_t>(raw, raw + BLOCK));
+    }
+
+    void read_checkpoint(CheckpointReader &r) {
+        engine = r.value<rng_t>();
+        next = r.value<unsigned int>();
+        auto values = r.vector<uint64_t>();
+        if (values.size() != BLOCK || next > BLOCK) throw std::runtime_error("Checkpoint has an invalid random block");
+        std::copy(values.begin(), values.end(), raw);
+        for(auto i = 0u; i<BLOCK; i++) block[i] = to_unit(raw[i]);
+    }
+
+private:
+    /* 53 high bits to a double in [0,1) */
+    static inline double to_unit(uint64_t bits) {
+        return (bits >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /* 64 random bits from the engine (two draws for 32-bit engines) */
+    template<typename E = rng_t>
+    inline typename std::enable_if<sizeof(typename E::result_type) >= 8, uint64_t>::type draw_bits() {
+        return engine();
+    }
+
+    template<typename E = rng_t>
+    inline typename std::enable_if<sizeof(typename E::result_type) < 8, uint64_t>::type draw_bits() {
+        uint64_t hi = engine();
+        return (hi << 32) | uint64_t(engine());
+    }
+
+    void refill() {
+        for(auto i = 0u; i<BLOCK; i++) raw[i] = draw_bits();
+        for(auto i = 0u; i<BLOCK; i++) block[i] = to_unit(raw[i]);
+        next = 0;
+    }
+
+    rng_t engine;
+    unsigned int next; // next unused value of the block
+    const ExponentialZiggurat *zig;
+    uint64_t raw[BLOCK];
+    double block[BLOCK];
+};
+
+} // namespace
+
+#endif
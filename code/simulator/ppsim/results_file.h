@@ -0,0 +1,331 @@
+#ifndef __RESULTS_FILE_H_
+#define __RESULTS_FILE_H_
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace pp {
+
+/*
+ * Append-only results container: one file holds the outputs of many replicates (e.g. all
+ * replicates of a case) instead of one small file per replicate.
+ *
+ *   header   ResultsFileHeader (16 bytes)
+ *   chunks   ResultsChunkHeader (40 bytes) followed by 'size' bytes of payload
+ *
+ * Each chunk is one output of one replicate (kind, case, replicate), e.g. its density series
+ * or summary line, optionally zlib-compressed. Chunks are appended with a single write under
+ * an exclusive lock (a mutex between threads and flock between processes), so concurrent
+ * runs can share a file. The chunk headers are the index: readers skip from header to
+ * header without reading payloads. A chunk cut short by a crash (which later runs may have
+ * appended to) is skipped by readers, which resynchronise at the next chunk.
+ */
+struct ResultsFileHeader {
+    char magic[8]; // "PPRESULT"
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct ResultsChunkHeader {
+    char magic[4]; // "PPRC"
+    uint32_t kind;
+    uint32_t case_id;
+    uint32_t replicate;
+    uint64_t size; // stored payload bytes
+    uint64_t raw_size; // payload bytes after decompression
+    uint32_t crc; // crc32 of the stored payload
+    uint32_t flags;
+};
+
+static_assert(sizeof(ResultsFileHeader) == 16, "Unexpected results file header size");
+static_assert(sizeof(ResultsChunkHeader) == 40, "Unexpected results chunk header size");
+
+static constexpr char RESULTS_FILE_MAGIC[8] = { 'P', 'P', 'R', 'E', 'S', 'U', 'L', 'T' };
+static constexpr char RESULTS_CHUNK_MAGIC[4] = { 'P', 'P', 'R', 'C' };
+
+/* Chunk kinds written by the simulator */
+enum ResultsKind : uint32_t { RESULTS_DENSITY = 1, RESULTS_SUMMARY = 2 };
+
+/* Chunk flags */
+static constexpr uint32_t RESULTS_COMPRESSED = 1;
+
+inline std::string results_kind_name(uint32_t kind) {
+    switch (kind) {
+        case RESULTS_DENSITY: return "density";
+        case RESULTS_SUMMARY: return "summary";
+        default: return "kind" + std::to_string(kind);
+    }
+}
+
+/* Appends chunks to a results file; one object can be shared by the threads of a process */
+class ResultsFile {
+public:
+    explicit ResultsFile(const std::string &fname, bool compress = true) : name(fname), compress(compress) {
+        create();
+        fd = ::open(fname.c_str(), O_WRONLY | O_APPEND);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open results file '" + fname + "': " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("'" + fname + "' is empty, not a results file");
+        }
+    }
+
+    ~ResultsFile() {
+        ::close(fd);
+    }
+
+    ResultsFile(const ResultsFile&) = delete;
+    ResultsFile &operator=(const ResultsFile&) = delete;
+
+    void append(uint32_t kind, uint32_t case_id, uint32_t replicate, const std::string &payload) {
+        ResultsChunkHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, RESULTS_CHUNK_MAGIC, sizeof(h.magic));
+        h.kind = kind;
+        h.case_id = case_id;
+        h.replicate = replicate;
+        h.raw_size = payload.size();
+
+        std::string chunk(sizeof(h), '\0');
+        if (compress && !payload.empty()) {
+            uLongf size = compressBound(payload.size());
+            chunk.resize(sizeof(h) + size);
+            auto data = reinterpret_cast<Bytef*>(&chunk[sizeof(h)]);
+            if (compress2(data, &size, reinterpret_cast<const Bytef*>(payload.data()), payload.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+                throw std::runtime_error("Could not compress results chunk");
+            }
+            chunk.resize(sizeof(h) + size);
+            h.flags |= RESULTS_COMPRESSED;
+        } else {
+            chunk += payload;
+        }
+        h.size = chunk.size() - sizeof(h);
+        h.crc = crc32(0L, reinterpret_cast<const Bytef*>(chunk.data() + sizeof(h)), h.size);
+        std::memcpy(&chunk[0], &h, sizeof(h));
+
+        std::lock_guard<std::mutex> guard(mutex);
+        FileLock lock(fd);
+        write_all(fd, chunk);
+    }
+
+private:
+    /*
+     * Create the file with its header if it does not exist. The header is written to a new
+     * (O_EXCL) temporary file that is then linked to the name, so the file never exists
+     * without its header and only one of several processes creating it at once succeeds.
+     */
+    void create() {
+        if (::access(name.c_str(), F_OK) == 0) return;
+        auto tmp = name + ".tmp." + std::to_string(::getpid());
+        int tfd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (tfd < 0) {
+            throw std::runtime_error("Could not create results file '" + tmp + "': " + strerror(errno));
+        }
+        ResultsFileHeader fh;
+        std::memset(&fh, 0, sizeof(fh));
+        std::memcpy(fh.magic, RESULTS_FILE_MAGIC, sizeof(fh.magic));
+        fh.version = 1;
+        try {
+            write_all(tfd, std::string(reinterpret_cast<const char*>(&fh), sizeof(fh)));
+        } catch (...) {
+            ::close(tfd);
+            ::unlink(tmp.c_str());
+            throw;
+        }
+        ::close(tfd);
+        int linked = ::link(tmp.c_str(), name.c_str());
+        int error = errno;
+        ::unlink(tmp.c_str());
+        if (linked != 0 && error != EEXIST) {
+            throw std::runtime_error("Could not create results file '" + name + "': " + strerror(error));
+        }
+    }
+
+    /* flock for the duration of an append; file systems without flock rely on O_APPEND alone */
+    struct FileLock {
+        FileLock(int f) : fd(f) { locked = flock(fd, LOCK_EX) == 0; }
+        ~FileLock() { if (locked) flock(fd, LOCK_UN); }
+        int fd;
+        bool locked;
+    };
+
+    void write_all(int f, const std::string &data) {
+        std::size_t written = 0;
+        while (written < data.size()) {
+            auto n = ::write(f, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error("Could not write results file '" + name + "': " + strerror(errno));
+            written += n;
+        }
+    }
+
+    std::string name;
+    bool compress;
+    int fd;
+    std::mutex mutex;
+};
+
+/*
+ * Output stream that becomes one chunk of a results file: everything written to it is
+ * collected in memory and appended as a single chunk when the stream is closed or destroyed,
+ * so any writer can write into a results file.
+ */
+class ResultsChunkStream : public std::ostream {
+public:
+    ResultsChunkStream(std::shared_ptr<ResultsFile> f, uint32_t kind, uint32_t case_id, uint32_t replicate)
+        : std::ostream(nullptr), file(f), kind(kind), case_id(case_id), replicate(replicate) {
+        rdbuf(&buffer);
+    }
+
+    ~ResultsChunkStream() {
+        try {
+            close();
+        } catch (const std::exception &e) {
+            std::cerr << "Results chunk lost: " << e.what() << std::endl;
+        }
+    }
+
+    void close() {
+        if (closed) return;
+        closed = true;
+        file->append(kind, case_id, replicate, buffer.str());
+    }
+
+private:
+    std::stringbuf buffer;
+    std::shared_ptr<ResultsFile> file;
+    uint32_t kind, case_id, replicate;
+    bool closed = false;
+};
+
+/* Reads the chunks of a results file */
+class ResultsReader {
+public:
+    struct Chunk {
+        uint64_t offset; // of the payload
+        ResultsChunkHeader header;
+    };
+
+    explicit ResultsReader(const std::string &fname) : name(fname), in(fname, std::ios::in | std::ios::binary) {
+        if (!in) throw std::runtime_error("Could not open results file '" + fname + "'");
+        in.seekg(0, std::ios::end);
+        uint64_t size = in.tellg();
+        in.seekg(0);
+        ResultsFileHeader fh;
+        if (size == 0) return;
+        if (!in.read(reinterpret_cast<char*>(&fh), sizeof(fh)) || std::memcmp(fh.magic, RESULTS_FILE_MAGIC, sizeof(fh.magic)) != 0) {
+            throw std::runtime_error("'" + fname + "' is not a results file");
+        }
+
+        /*
+         * Skip from header to header. A chunk is complete if it ends at the end of the file or
+         * at the next chunk header, or else if its checksum holds; otherwise it was cut short,
+         * and the next chunk starts at the next chunk magic after its header.
+         */
+        uint64_t offset = sizeof(fh);
+        while (offset + sizeof(ResultsChunkHeader) <= size) {
+            Chunk c;
+            in.seekg(offset);
+            in.read(reinterpret_cast<char*>(&c.header), sizeof(c.header));
+            c.offset = offset + sizeof(c.header);
+            auto end = c.offset + c.header.size;
+            if (in && std::memcmp(c.header.magic, RESULTS_CHUNK_MAGIC, sizeof(c.header.magic)) == 0 && end <= size
+                && (end == size || is_chunk_magic(end) || checksum_holds(c))) {
+                index.push_back(c);
+                offset = end;
+                continue;
+            }
+            in.clear();
+            truncated = true;
+            offset = find_chunk_magic(offset + 1, size);
+        }
+        truncated = truncated || offset < size;
+        in.clear();
+    }
+
+    const std::vector<Chunk> &chunks() const { return index; }
+
+    /* Was a chunk of the file cut short (and skipped)? */
+    bool is_truncated() const { return truncated; }
+
+    std::string read(const Chunk &c) {
+        auto stored = read_stored(c);
+        if (crc32(0L, reinterpret_cast<const Bytef*>(stored.data()), stored.size()) != c.header.crc) {
+            throw std::runtime_error("Checksum mismatch in results file '" + name + "'");
+        }
+        if (!(c.header.flags & RESULTS_COMPRESSED)) return stored;
+
+        std::string payload(c.header.raw_size, '\0');
+        uLongf size = payload.size();
+        if (uncompress(reinterpret_cast<Bytef*>(&payload[0]), &size, reinterpret_cast<const Bytef*>(stored.data()), stored.size()) != Z_OK
+            || size != payload.size()) {
+            throw std::runtime_error("Could not decompress results chunk");
+        }
+        return payload;
+    }
+
+private:
+    std::string read_stored(const Chunk &c) {
+        std::string stored(c.header.size, '\0');
+        in.seekg(c.offset);
+        if (!in.read(&stored[0], stored.size())) throw std::runtime_error("Could not read results chunk");
+        return stored;
+    }
+
+    bool checksum_holds(const Chunk &c) {
+        auto stored = read_stored(c);
+        return crc32(0L, reinterpret_cast<const Bytef*>(stored.data()), stored.size()) == c.header.crc;
+    }
+
+    bool is_chunk_magic(uint64_t offset) {
+        char magic[sizeof(RESULTS_CHUNK_MAGIC)];
+        in.seekg(offset);
+        bool found = in.read(magic, sizeof(magic)) && std::memcmp(magic, RESULTS_CHUNK_MAGIC, sizeof(magic)) == 0;
+        in.clear();
+        return found;
+    }
+
+    /* Offset of the next chunk magic at or after from, or the file size if there is none */
+    uint64_t find_chunk_magic(uint64_t from, uint64_t size) {
+        const uint64_t BLOCK = 1 << 16;
+        const std::string magic(RESULTS_CHUNK_MAGIC, sizeof(RESULTS_CHUNK_MAGIC));
+        std::string block;
+        for(auto pos = from; pos + magic.size() <= size; pos += BLOCK) {
+            block.resize(std::min<uint64_t>(BLOCK + magic.size() - 1, size - pos));
+            in.seekg(pos);
+            if (!in.read(&block[0], block.size())) break;
+            auto i = block.find(magic);
+            if (i != std::string::npos) return pos + i;
+        }
+        in.clear();
+        return size;
+    }
+
+    std::string name;
+    std::ifstream in;
+    std::vector<Chunk> index;
+    bool truncated = false;
+};
+
+} // namespace
+
+#endif
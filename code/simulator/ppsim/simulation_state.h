@@ -28,9 +28,10 @@ class SimulationState {
 public:
     static constexpr unsigned int DIM = 2; // TODO: Generalise
 
-    SimulationState(double u, uint_t me, uint_t re) : stats(Statistics(re)), U_value(u), max_entities(me) {
+    /* ghost_radius: distance queries up to this radius avoid periodic wrapping (see PointSet) */
+    SimulationState(double u, uint_t me, uint_t re, double ghost_radius = 0) : stats(Statistics(re)), U_value(u), max_entities(me) {
         for(auto i = 0u; i<max_entities+1; i++) {
-            point_sets.push_back(std::make_shared<PointSet>(u, 1)); 
+            point_sets.push_back(std::make_shared<PointSet>(u, 1, ghost_radius)); 
         }
     }
 
@@ -42,16 +43,83 @@ public:
         point_sets[p->get_entity()]->destroy_point(p);
     }
 
-    inline rng_t &rng() { return rng_instance; }
+    inline RandomSource &rng() { return random; }
     inline coord_t U() const { return U_value; }
     inline coord_t area() const { return U_value * U_value; }
     inline Coord center() const { return Coord(U_value/2, U_value/2); }
 
+    /* 
+     * Make this state, which must be empty and have the same domain and entities, a copy of o
+     * including its statistics and random generator (see PointSet::copy_from).
+     */
+    void copy_from(const SimulationState &o) {
+        if (point_sets.size() != o.point_sets.size() || U_value != o.U_value) {
+            throw std::runtime_error("SimulationState::copy_from: states of different domains or entities");
+        }
+        for(auto i = 0u; i<point_sets.size(); i++) {
+            point_sets[i]->copy_from(*o.point_sets[i]);
+        }
+        stats = o.stats;
+        random = o.random;
+    }
+
+    /* Points, statistics and random generator (see PointSet::write_checkpoint) */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value(U_value);
+        w.value<uint64_t>(point_sets.size());
+        for(auto &ps : point_sets) {
+            ps->write_checkpoint(w);
+        }
+        w.value(stats.time);
+        w.vector(stats.number_of_events);
+        w.value(stats.total_events);
+        random.write_checkpoint(w);
+    }
+
+    /* Restore into this empty state, which must have the same domain and entities */
+    void read_checkpoint(CheckpointReader &r) {
+        r.expect(U_value, "domain");
+        r.expect<uint64_t>(point_sets.size(), "entities");
+        for(auto i = 0u; i<point_sets.size(); i++) {
+            point_sets[i]->read_checkpoint(r, i);
+        }
+        stats.time = r.value<double>();
+        auto events = r.vector<uint_t>();
+        if (events.size() != stats.number_of_events.size()) {
+            throw std::runtime_error("Checkpoint does not match the simulation: different processes");
+        }
+        stats.number_of_events = events;
+        stats.total_events = r.value<uint_t>();
+        random.read_checkpoint(r);
+    }
+
+    /* A point of any entity written as its entity, bucket and slot */
+    void write_ref(CheckpointWriter &w, const Point *p) const {
+        w.value<uint32_t>(p->get_entity());
+        point_sets[p->get_entity()]->write_ref(w, p);
+    }
+
+    Point *read_ref(CheckpointReader &r) const {
+        auto e = r.value<uint32_t>();
+        if (e >= point_sets.size()) throw std::runtime_error("Checkpoint refers to an unknown entity");
+        return point_sets[e]->read_ref(r);
+    }
+
+    /* The copy of point p of the state this one was copied from */
+    inline Point *corresponding(const Point *p) const {
+        return point_sets[p->get_entity()]->corresponding(p);
+    }
+
     /* Get the entity count */
     inline int get_max_entities() const { 
         return max_entities; 
     }
 
+    /* Use an adaptive index for crowded cells of the given entity (see PointSet::set_max_occupancy) */
+    void set_max_occupancy(uint_t entity, uint_t n) {
+        point_sets.at(entity)->set_max_occupancy(n);
+    }
+
     /* Distance query around point p. Fill the query buffer with results */
     void query_points(uint_t entity, const Point *p, coord_t distance, point_query_t &buffer) {
         point_sets[entity]->get_within(p, distance, buffer);
@@ -97,7 +165,12 @@ public:
 
     /* Random value from range [0,1) */
     inline double random_value() { 
-        return uniform_distribution(rng_instance); 
+        return random.uniform(); 
+    }
+
+    /* Exponentially distributed random value with rate 1 */
+    inline double random_exponential() { 
+        return random.exponential(); 
     }
 
     /* Random coordinate in the UxU space */
@@ -112,7 +185,12 @@ public:
 
     template<typename T>
     void seed(T &s) {
-        rng_instance.seed(s);
+        random.seed(s);
+    }
+
+    /* Use the stream id of the generator seeded with master_seed (see StreamId) */
+    void seed_stream(uint64_t master_seed, const StreamId &id) {
+        random.seed_stream(master_seed, id);
     }
 
     Statistics stats;
@@ -129,7 +207,7 @@ private:
     uint_t max_entities; 
     point_enum_buf_t enum_buffer;
     std::vector<std::shared_ptr<PointSet>> point_sets; // indexing from 1.. max_entities
-    rng_t rng_instance;
+    RandomSource random;
 };
 
 
@@ -4,7 +4,11 @@
 #include <stdexcept>
 #include <sstream>
 #include <memory>
+#include <limits>
+#include <cmath>
+#include <csignal>
 #include "model.h"
+#include "static_model.h"
 #include "tracker.h"
 
 namespace pp {
@@ -12,15 +16,34 @@ namespace pp {
 /* If total propensity falls below this, halt.. */
 static constexpr double MINIMUM_HALT_PROPENSITY = 1e-10;
 
-class Simulator {
+/* Halt when there are no points of the entity left; only needs checking when such a point is removed */
+struct CheckExtinction {
+    CheckExtinction(uint_t e) : entity(e) {}
+    uint_t entity;
+
+    bool operator()(const SimulationState &s) {
+        return (s.get_count(entity) == 0);
+    }
+};
+
+/*
+ * Gillespie simulation of a model. M is either the runtime Model or a StaticModel whose
+ * process list is fixed at compile time; both provide the same interface.
+ */
+template<typename M>
+class BasicSimulator {
 public:
     using HaltingConditionFunctor = std::function<bool(SimulationState const&)>;
+    using model_t = M;
 
-    Simulator(double U, Model m) : done(false),
+    BasicSimulator(double U, M m) : done(false),
                                    model(m), 
-                                   simulation_state(SimulationState(U, m.max_entity_id(), m.process_count())) { 
+                                   simulation_state(SimulationState(U, m.max_entity_id(), m.process_count(),
+                                                                    USE_GHOST_CELLS ? m.max_input_radius() : 0)) { 
         model.initialise(&simulation_state);
         current_propensities.resize(m.process_count());
+        entity_halting_conditions.resize(simulation_state.get_max_entities()+1);
+        entity_changed.resize(simulation_state.get_max_entities()+1, 0);
     }
 
     void add_new_point(Coord c, uint_t entity) {
@@ -40,12 +63,21 @@ public:
 
         auto tau = next_time(); // FIXME: check that tau is finite
         auto rid = next_reaction(); 
+
+        /* Grid times before the event see the current state */
+        if (simulation_state.stats.time + tau > next_write_time) {
+            write_scheduled(simulation_state.stats.time + tau);
+        }
+
         simulation_state.stats.update(tau, rid);
         run_reaction(rid);
 
-        /* Notify writers */
-        for(auto &w : writers) {
-            w->process_activated(simulation_state, tau, rid);
+        /* Event-driven halting conditions */
+        if (any_entity_changed) {
+            check_entity_halting_conditions();
+        }
+        if (simulation_state.stats.time >= halt_time) {
+            halt(halt_time_condition);
         }
 
         return tau;
@@ -55,38 +87,134 @@ public:
     void run(double t) {
         DMSG("run(" << t << ")");
         halt_reason = "Maximum time limit reached."; // default reason
+        run_end_time = simulation_state.stats.time + t;
 
         /* Notify writers that simulation starts */
         for(auto &w : writers) {
             w->start(simulation_state);
         }
+        schedule_writers(run_end_time);
 
-        double total_time = 0;
-        while (total_time < t && !is_done()) {
-            total_time += step();
+        /* The initial state may already satisfy a halting condition */
+        check_all_halting_conditions();
+
+        run_to_end();
+    }
+
+    /* Continue the run restored from a checkpoint (see read_checkpoint) until its end time */
+    void resume() {
+        DMSG("resume()");
+        run_to_end();
+    }
+
+    /*
+     * Call save between events every 'every' time units (if every > 0) and whenever *request is
+     * set, e.g. by a signal handler, which clears the request. The run halts if save returns true.
+     * Checkpoints do not touch the random stream, so they do not change the trajectory.
+     */
+    void set_checkpointing(std::function<bool()> save, double every, volatile sig_atomic_t *request = nullptr) {
+        checkpoint_save = save;
+        checkpoint_every = every;
+        checkpoint_request = request;
+        schedule_checkpoint();
+    }
+
+    /* 
+     * Write the state of a run in progress: the points, tracked configurations, statistics and
+     * random generator, and the progress of the run and its writers. Halting conditions are not 
+     * written; a restored simulator gets them by the same setup as the original.
+     */
+    void write_checkpoint(CheckpointWriter &w) const {
+        simulation_state.write_checkpoint(w);
+        model.write_checkpoint(w);
+        w.value<char>(done);
+        w.string(halt_reason);
+        w.value(run_end_time);
+        w.value(write_end_time);
+        w.vector(next_writes);
+        w.value<uint64_t>(writers.size());
+        for(auto &writer : writers) {
+            writer->write_checkpoint(w);
         }
+    }
 
-        /* Notify writers that simulation starts */
+    /*
+     * Replace the state by that of a checkpoint, to be continued with resume(). The simulator
+     * must run the same model with the same halting conditions and writers as the original.
+     */
+    void read_checkpoint(CheckpointReader &r) {
+        clear_state();
+        simulation_state.read_checkpoint(r);
+        model.read_checkpoint(r);
+        done = r.value<char>();
+        halt_reason = r.string();
+        run_end_time = r.value<double>();
+        write_end_time = r.value<double>();
+        next_writes = r.vector<double>();
+        r.expect<uint64_t>(writers.size(), "writers");
+        for(auto &writer : writers) {
+            writer->read_checkpoint(r);
+        }
+        next_write_time = std::numeric_limits<double>::infinity();
+        for(auto t : next_writes) {
+            if (t <= write_end_time) next_write_time = std::min(next_write_time, t);
+        }
+        schedule_checkpoint();
+    }
+
+    /* Flush the output of the writers, e.g. before recording the output sizes of a checkpoint */
+    void flush_writers() {
         for(auto &w : writers) {
-            w->end(simulation_state);
+            w->flush();
         }
     }
 
-    bool is_done() {
-        for(auto i = 0u; i<halting_conditions.size(); i++) {
-            auto &f = halting_conditions[i];
-            if (f(simulation_state)) {
-                DMSG("Halting condition " << i << " triggered.");
-                done = true;
-                std::stringstream s; 
-                s << "Halting condition #" << i << " triggered";
-                halt_reason = s.str();
-                break;
+    /* 
+     * Has the simulation halted? Only the polled halting conditions (if any) and the halt flag 
+     * are checked here; entity and time conditions are checked when they can change.
+     */
+    inline bool is_done() {
+        if (!done) {
+            if (halt_flag != nullptr && *halt_flag) {
+                halt(halt_flag_condition);
+            } else if (!halting_conditions.empty()) {
+                check_polled_halting_conditions();
             }
         }
         return done;
     }
 
+    /*
+     * Start from a copy of the state of o, e.g. of a prototype set up once for many replicates:
+     * its points, tracked configurations, statistics, random generator and halting conditions.
+     * This simulator must be empty and run a clone of the model of o; writers are not copied.
+     * The copy continues the random stream of o unless it is reseeded afterwards.
+     */
+    void copy_state_from(const BasicSimulator &o) {
+        if (simulation_state.get_count() > 0) {
+            throw std::runtime_error("Simulator::copy_state_from: the simulator already has points");
+        }
+        simulation_state.copy_from(o.simulation_state);
+        model.copy_state_from(o.model);
+
+        halting_condition_count = o.halting_condition_count;
+        halting_conditions = o.halting_conditions;
+        entity_halting_conditions = o.entity_halting_conditions;
+        halt_time = o.halt_time;
+        halt_time_condition = o.halt_time_condition;
+        halt_flag = o.halt_flag;
+        halt_flag_condition = o.halt_flag_condition;
+        done = o.done;
+        halt_reason = o.halt_reason;
+    }
+
+    /* Remove all points and tracked configurations; the halting conditions and writers stay */
+    void clear_state() {
+        model = model.clone();
+        simulation_state = SimulationState(simulation_state.U(), model.max_entity_id(), model.process_count(),
+                                           USE_GHOST_CELLS ? model.max_input_radius() : 0);
+        model.initialise(&simulation_state);
+    }
 
     /* Randomly add points of given entity type with density */
     void fill(uint_t entity, double density) {
@@ -110,17 +238,60 @@ public:
         }
     }
 
+    /* Bound the occupancy of the spatial index cells of an entity; useful for clustered points */
+    void set_max_cell_occupancy(uint_t entity, uint_t n) {
+        simulation_state.set_max_occupancy(entity, n);
+    }
+
+    /* 
+     * Halting conditions. Each one gets the next condition number, which shows up in the halt reason. 
+     * Conditions added with add_halting_condition are evaluated before every step; prefer the 
+     * cheaper kinds below when possible.
+     */
     template<typename F>
     void add_halting_condition(F f) {
-        halting_conditions.push_back(f);
+        halting_conditions.push_back(std::make_pair(halting_condition_count++, HaltingConditionFunctor(f)));
+    }
+
+    /* Extinction only needs checking when points of the entity change */
+    void add_halting_condition(CheckExtinction c) {
+        add_entity_halting_condition(c.entity, c);
+    }
+
+    /* Evaluate f only after events that add or remove points of the entity */
+    template<typename F>
+    void add_entity_halting_condition(uint_t entity, F f) {
+        entity_halting_conditions.at(entity).push_back(std::make_pair(halting_condition_count++, HaltingConditionFunctor(f)));
+    }
+
+    /* Halt at the first event at or after time t */
+    void add_time_halting_condition(double t) {
+        if (t < halt_time) {
+            halt_time = t;
+            halt_time_condition = halting_condition_count;
+        }
+        halting_condition_count++;
+    }
+
+    /* Halt when *flag becomes nonzero, e.g. a flag set by a signal handler */
+    void add_halting_flag(const volatile sig_atomic_t *flag) {
+        halt_flag = flag;
+        halt_flag_condition = halting_condition_count++;
     }
 
     template<typename W, typename... Args>
-    void make_writer(const Args&... args) {
-        writers.push_back(std::unique_ptr<W>(new W(args...)));
+    W &make_writer(const Args&... args) {
+        auto w = new W(args...);
+        writers.push_back(std::unique_ptr<W>(w));
+        if (auto l = dynamic_cast<EventListener*>(w)) {
+            event_listeners.push_back(l);
+        }
+        next_writes.push_back(std::numeric_limits<double>::infinity());
+        schedule_writers(write_end_time);
+        return *w;
     }
 
-    const Model &get_model() const { return model; }
+    const M &get_model() const { return model; }
     const SimulationState &get_state() const { return simulation_state; }
 
     std::string get_halt_reason() const { return halt_reason; }
@@ -130,15 +301,15 @@ public:
         simulation_state.seed(s);
     }
 
+    void set_stream(uint64_t master_seed, const StreamId &id) {
+        simulation_state.seed_stream(master_seed, id);
+    }
+
     void update_propensity() {
         DMSG("update_propensity()");
 
-        auto & trackers = model.get_trackers();
-        for(auto i = 0; i<trackers.size(); i++) {
-            auto p = trackers[i]->propensity();
-            current_propensities[i] = p;
-            DMSG(t->get_process() << " has propensity " << t->propensity());
-        }
+        model.update_propensities(current_propensities);
+        DMSG("Propensities: " << join(" + ", current_propensities));
         
         current_propensity = sum_kh(current_propensities);
         // std::cout << std::fixed << std::setprecision(10) << "Propensities: " << join(" + ", current_propensities) << " = " << current_propensity << std::endl;
@@ -152,9 +323,7 @@ public:
 
     /* Sample time until the next event */
     inline double next_time() { 
-        auto rval = simulation_state.random_value();
-        //auto tau = 1.0/current_propensity * log(1.0/rval);
-        auto tau = -log(rval)/current_propensity;
+        auto tau = simulation_state.random_exponential()/current_propensity;
         DMSG("next_time() = " << tau);
         return tau;
     }
@@ -165,7 +334,7 @@ public:
         double mass = 0.0; // propensity mass
         double correction = 0; // correction term
 
-        for(auto rid = 0; rid < model.get_trackers().size(); rid++) {
+        for(auto rid = 0u; rid < model.process_count(); rid++) {
             auto p = current_propensities[rid];
             // A naive summation:
             //mass += p;
@@ -186,6 +355,115 @@ public:
         throw std::runtime_error("Simulator::next_reaction(): total propensity was less than sum of all propensities!");
     }
 
+    void halt(uint_t condition) {
+        DMSG("Halting condition " << condition << " triggered.");
+        done = true;
+        std::stringstream s; 
+        s << "Halting condition #" << condition << " triggered";
+        halt_reason = s.str();
+    }
+
+    void check_polled_halting_conditions() {
+        for(auto &c : halting_conditions) {
+            if (c.second(simulation_state)) {
+                halt(c.first);
+                return;
+            }
+        }
+    }
+
+    void check_entity_halting_conditions() {
+        any_entity_changed = false;
+        for(auto e = 0u; e<entity_changed.size(); e++) {
+            if (!entity_changed[e]) continue;
+            entity_changed[e] = 0;
+            for(auto &c : entity_halting_conditions[e]) {
+                if (!done && c.second(simulation_state)) {
+                    halt(c.first);
+                }
+            }
+        }
+    }
+
+    void check_all_halting_conditions() {
+        std::fill(entity_changed.begin(), entity_changed.end(), 1);
+        any_entity_changed = true;
+        check_entity_halting_conditions();
+        if (!done && simulation_state.stats.time >= halt_time) {
+            halt(halt_time_condition);
+        }
+        is_done();
+    }
+
+    /* Mark an entity count as changed if some halting condition watches it */
+    inline void entity_count_changed(uint_t entity) {
+        if (!entity_halting_conditions[entity].empty()) {
+            entity_changed[entity] = 1;
+            any_entity_changed = true;
+        }
+    }
+
+    /* Schedule the writers at their next grid times after the current time, up to end_time */
+    void schedule_writers(double end_time) {
+        write_end_time = end_time;
+        next_write_time = std::numeric_limits<double>::infinity();
+        for(auto i = 0u; i<writers.size(); i++) {
+            auto delta = writers[i]->delta;
+            if (delta > 0) {
+                next_writes[i] = (std::floor(simulation_state.stats.time / delta) + 1) * delta;
+                next_write_time = std::min(next_write_time, next_writes[i]);
+            } else {
+                next_writes[i] = std::numeric_limits<double>::infinity();
+            }
+        }
+    }
+
+    /* Write the current state at all scheduled times before time t */
+    void write_scheduled(double t) {
+        next_write_time = std::numeric_limits<double>::infinity();
+        for(auto i = 0u; i<writers.size(); i++) {
+            auto &w = writers[i];
+            while (next_writes[i] < t && next_writes[i] <= write_end_time) {
+                w->write(simulation_state, next_writes[i]);
+                /* multiply instead of adding delta so that the grid does not drift */
+                next_writes[i] = (std::round(next_writes[i] / w->delta) + 1) * w->delta;
+            }
+            if (next_writes[i] <= write_end_time) {
+                next_write_time = std::min(next_write_time, next_writes[i]);
+            }
+        }
+    }
+
+    /* Run until the end time of the run, checkpointing as requested, and end the writers */
+    void run_to_end() {
+        while (simulation_state.stats.time < run_end_time && !is_done()) {
+            step();
+            if (checkpoint_save && (simulation_state.stats.time >= next_checkpoint || (checkpoint_request && *checkpoint_request))) {
+                checkpoint();
+            }
+        }
+
+        /* Notify writers that simulation ends */
+        for(auto &w : writers) {
+            w->end(simulation_state);
+        }
+    }
+
+    void checkpoint() {
+        bool stop = checkpoint_save();
+        if (checkpoint_request) *checkpoint_request = 0;
+        schedule_checkpoint();
+        if (stop) {
+            done = true;
+            halt_reason = "Stopped after writing a checkpoint.";
+        }
+    }
+
+    void schedule_checkpoint() {
+        next_checkpoint = checkpoint_every > 0 ? (std::floor(simulation_state.stats.time / checkpoint_every) + 1) * checkpoint_every 
+                                               : std::numeric_limits<double>::infinity();
+    }
+
     /* Execute the selected reaction */
     inline void run_reaction(uint_t rid) {
         DMSG("run_reaction(" << rid << ")");
@@ -194,8 +472,12 @@ public:
         product_buffer.clear();
 
         // Execute the process & populate buffers 
-        DMSG("activating process "<< model.get_tracker(rid) << " which is " << model.get_tracker(rid)->get_process());
-        model.get_tracker(rid)->activate(reactant_buffer, product_buffer);
+        DMSG("activating process " << model.get_process(rid));
+        model.activate(rid, reactant_buffer, product_buffer);
+
+        for(auto l : event_listeners) {
+            l->event(simulation_state, rid, reactant_buffer, product_buffer);
+        }
 
         // Update simulation state and notify process trackers to update their state
 
@@ -203,10 +485,8 @@ public:
         DMSG("Removing " << reactant_buffer.size() << " reactants");
         for(auto p : reactant_buffer) { 
             DMSG("- Processing " << *p << " = " << p );
-            for(auto rid : model.get_dependencies(p->get_entity())) {
-                DMSG("- Notifying process " << rid);
-                model.get_tracker(rid)->notify_removal(*p);
-            }
+            model.notify_removal(*p);
+            entity_count_changed(p->get_entity());
             DMSG("- Deleting point " << p);
             simulation_state.destroy_point(p); // invalidates p!!!
         }
@@ -218,14 +498,13 @@ public:
         for(auto p : product_buffer) {
             simulation_state.add(p);
             process_added(p);
+            entity_count_changed(p->get_entity());
         }
     }
 
     void process_added(Point *p) {
         // Inform all trackers of the existence of a new point p
-        for(auto rid : model.get_dependencies(p->get_entity())) {
-            model.get_tracker(rid)->notify_add(*p);
-        }
+        model.notify_add(*p);
     }
 
     // ---- Local variables of the object ----
@@ -235,24 +514,36 @@ public:
     std::vector<double> current_propensities; // propensity of each process
     double current_propensity; // sum of the above
 
-    Model model; // the model specification and trackers
+    M model; // the model specification and trackers
     SimulationState simulation_state; // current state of the simulation
     point_del_buf_t reactant_buffer; // buffer for reactants (removed points)
     point_add_buf_t product_buffer; // buffer for products (added points) 
-    std::vector<HaltingConditionFunctor> halting_conditions; // list of functions checking halting condition
+    using numbered_conditions_t = std::vector<std::pair<uint_t, HaltingConditionFunctor>>;
+    uint_t halting_condition_count = 0; // number of halting conditions of any kind
+    numbered_conditions_t halting_conditions; // conditions polled before every step
+    std::vector<numbered_conditions_t> entity_halting_conditions; // entity -> conditions watching it
+    std::vector<char> entity_changed; // entity -> did its count change during the last event
+    bool any_entity_changed = false;
+    double halt_time = std::numeric_limits<double>::infinity(); // earliest time halting condition
+    uint_t halt_time_condition = 0;
+    const volatile sig_atomic_t *halt_flag = nullptr;
+    uint_t halt_flag_condition = 0;
     std::vector<std::unique_ptr<Writer>> writers; // state writers
+    std::vector<EventListener*> event_listeners; // writers that want every event
+    std::vector<double> next_writes; // next grid time of each writer
+    double next_write_time = std::numeric_limits<double>::infinity(); // earliest of next_writes
+    double write_end_time = std::numeric_limits<double>::infinity(); // no writes after this time
+    double run_end_time = 0; // end time of the current run
+    std::function<bool()> checkpoint_save; // writes a checkpoint; true to halt
+    double checkpoint_every = 0;
+    double next_checkpoint = std::numeric_limits<double>::infinity();
+    volatile sig_atomic_t *checkpoint_request = nullptr;
 };
 
-struct CheckExtinction {
-    CheckExtinction(uint_t e) : entity(e) {}
-    uint_t entity;
-
-    bool operator()(const SimulationState &s) {
-        return (s.get_count(entity) == 0);
-    }
-};
+using Simulator = BasicSimulator<Model>;
 
-std::ostream &operator<< (std::ostream &os, const pp::Simulator &s) {
+template<typename M>
+std::ostream &operator<< (std::ostream &os, const pp::BasicSimulator<M> &s) {
     return os << "Simulator(" << s.get_state() << ", " << s.get_model() << ")";
 }
 
@@ -0,0 +1,142 @@
+#ifndef __SPLITTING_H_
+#define __SPLITTING_H_
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+
+#include "simulator.h"
+#include "thread_pool.h"
+
+namespace pp {
+
+struct SplittingSettings {
+    uint_t entity; // progress coordinate: the count of this entity
+    std::vector<double> levels; // increasing counts at which trajectories are split
+    uint_t outcome_entity; // success if this entity survives until the end time
+    double time; // end time of the trajectories
+    uint32_t trajectories; // trajectories per stage
+};
+
+struct SplittingResult {
+    double probability = 0; // estimate of the success probability
+    std::vector<uint32_t> crossed; // trajectories that reached each level
+    uint32_t succeeded = 0; // trajectories that ended with the outcome entity alive
+    uint64_t segments = 0; // trajectory pieces simulated
+};
+
+/*
+ * Run s until the count of the entity reaches the level (true) or the run ends (false): it
+ * halts or reaches the end time, as BasicSimulator::run would end it. A run whose last event
+ * crosses both the end time and the level has ended.
+ */
+template<typename S>
+bool run_to_level(S &s, uint_t entity, double level, double end_time) {
+    s.check_all_halting_conditions();
+    while (true) {
+        if (s.is_done() || s.get_state().stats.time >= end_time) return false;
+        if (s.get_state().get_count(entity) >= level) return true;
+        s.step();
+    }
+}
+
+/*
+ * Fixed-effort multilevel splitting estimate of the probability that the outcome entity
+ * survives until the end time, for events too rare to sample by plain replicates.
+ *
+ * Stage 0 runs the given number of trajectories from the initial state (start(k) gives the
+ * k-th one), each with weight 1/N, until the progress coordinate reaches the first level or
+ * the trajectory ends. Every later stage runs N copies of the states at which the trajectories
+ * of the previous stage entered their level: each of the K entrants is copied n = N/K times
+ * (or once more), each copy with 1/n of its weight, and reseed(s, stage, k) gives the k-th
+ * copy its own random stream. The last stage runs to the end time. A trajectory that ends
+ * before reaching its level is scored by its outcome at that point, so the outcome need not
+ * imply crossing the levels.
+ *
+ * The sum of the weights of the successful trajectories is an unbiased estimate of the
+ * probability; its variance is best estimated from independent repetitions. The levels only
+ * affect the variance: they should be counts that trajectories reach with probabilities of
+ * the order of 1/10 to 1/2 from the previous level. The N states of a stage are held in memory.
+ */
+template<typename M, typename Start, typename Reseed>
+SplittingResult multilevel_splitting(const SplittingSettings &settings, Start start, Reseed reseed, ThreadPool &pool) {
+    using simulator_t = BasicSimulator<M>;
+    struct Trajectory {
+        std::shared_ptr<simulator_t> simulator;
+        double weight;
+    };
+    auto N = settings.trajectories;
+    if (N == 0) {
+        throw std::runtime_error("Multilevel splitting needs at least one trajectory per stage");
+    }
+    for(auto i = 1u; i<settings.levels.size(); i++) {
+        if (!(settings.levels[i] > settings.levels[i-1])) {
+            throw std::runtime_error("Splitting levels must be increasing");
+        }
+    }
+
+    SplittingResult result;
+    std::vector<Trajectory> entrants; // states at which the trajectories entered the last level
+    for(auto stage = 0u; stage <= settings.levels.size(); stage++) {
+        bool last = stage == settings.levels.size();
+        auto level = last ? std::numeric_limits<double>::infinity() : settings.levels[stage];
+
+        /* parent and weight of each trajectory of this stage */
+        std::vector<std::pair<uint32_t, double>> parents;
+        if (stage == 0) {
+            parents.assign(N, std::make_pair(0u, 1.0/N));
+        } else {
+            auto K = uint32_t(entrants.size());
+            for(auto j = 0u; j<K; j++) {
+                auto n = N/K + (j < N % K);
+                for(auto c = 0u; c<n; c++) {
+                    parents.push_back(std::make_pair(j, entrants[j].weight/n));
+                }
+            }
+        }
+
+        std::vector<Trajectory> runs(parents.size());
+        std::vector<char> reached(parents.size(), 0), succeeded(parents.size(), 0);
+        for(auto k = 0u; k<parents.size(); k++) {
+            pool.submit([&, k, stage, level]() {
+                std::shared_ptr<simulator_t> s;
+                if (stage == 0) {
+                    s = start(k);
+                } else {
+                    auto &parent = *entrants[parents[k].first].simulator;
+                    s = std::make_shared<simulator_t>(parent.get_state().U(), parent.get_model().clone());
+                    s->copy_state_from(parent);
+                    reseed(*s, stage, k);
+                }
+                if (run_to_level(*s, settings.entity, level, settings.time)) {
+                    reached[k] = 1;
+                    runs[k] = Trajectory { s, parents[k].second };
+                } else {
+                    succeeded[k] = s->get_state().get_count(settings.outcome_entity) > 0;
+                }
+            });
+        }
+        pool.wait();
+        result.segments += parents.size();
+
+        entrants.clear();
+        for(auto k = 0u; k<parents.size(); k++) {
+            if (succeeded[k]) {
+                result.probability += parents[k].second;
+                result.succeeded++;
+            }
+            if (reached[k]) entrants.push_back(runs[k]);
+        }
+        if (last) break;
+        result.crossed.push_back(entrants.size());
+        if (entrants.empty()) break; // no trajectory reached this level
+    }
+    result.crossed.resize(settings.levels.size(), 0);
+    return result;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef __STATIC_MODEL_H_
+#define __STATIC_MODEL_H_
+
+#include <memory>
+#include <set>
+#include <tuple>
+#include <array>
+#include <stdexcept>
+
+#include "sprocess.h"
+#include "tracker.h"
+
+namespace pp {
+
+/* C++11 stand-ins for std::index_sequence and std::make_index_sequence */
+template<std::size_t... I>
+struct index_sequence {};
+
+template<std::size_t N, std::size_t... I>
+struct make_index_sequence : make_index_sequence<N-1, N-1, I...> {};
+
+template<std::size_t... I>
+struct make_index_sequence<0, I...> : index_sequence<I...> {};
+
+/* Evaluate an expression for each element of a pack, in order */
+#define PP_UNROLL(expr) do { int unroll_[] = { 0, ((expr), 0)... }; (void) unroll_; } while (false)
+
+/*
+ *  Model with a process list that is fixed at compile time.
+ *
+ *  Same interface as Model, but the trackers are stored by value in a tuple, so that
+ *  BasicSimulator<StaticModel<...>> calls them without virtual dispatch and the loops over
+ *  processes are unrolled. Entity ids are only known at runtime, so the entity -> process
+ *  dependencies are a table of bit masks over the (compile-time) process indices.
+ *
+ *  Copies share the trackers, like copies of Model do.
+ */
+template<typename... Ps>
+class StaticModel {
+public:
+    static constexpr uint_t N = sizeof...(Ps);
+    static_assert(N <= 64, "StaticModel supports at most 64 processes");
+
+    using trackers_t = std::tuple<ImplTracker<Ps, Ps::input_count>...>;
+    using indices_t = make_index_sequence<sizeof...(Ps)>;
+
+    StaticModel(Ps... ps) : trackers(std::make_shared<trackers_t>(ps...)) {
+        set_processes(indices_t());
+        for(auto p : processes) {
+            update_entities(*p);
+        }
+        compute_dependencies();
+    }
+
+    uint_t max_entity_id() const { return *entities.rbegin(); }
+    uint_t process_count() const { return N; }
+
+    /* Largest distance at which any process looks for its inputs */
+    double max_input_radius() const {
+        double r = 0;
+        for(auto p : processes) {
+            r = std::max(r, p->get_input_radius());
+        }
+        return r;
+    }
+
+    void initialise(SimulationState *s) {
+        initialise(s, indices_t());
+    }
+
+    /* The process list is complete on construction */
+    void done() {}
+
+    /* Same processes with fresh trackers (copies share the trackers, see Model::clone) */
+    StaticModel clone() const {
+        return clone(indices_t());
+    }
+
+    /* Copy the tracked state of the model o (see Model::copy_state_from) */
+    void copy_state_from(const StaticModel &o) {
+        copy_state_from(o, indices_t());
+    }
+
+    /* Tracked state of the processes for checkpoints (see Model::write_checkpoint) */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value<uint64_t>(N);
+        write_checkpoint(w, indices_t());
+    }
+
+    void read_checkpoint(CheckpointReader &r) {
+        r.expect<uint64_t>(N, "processes");
+        read_checkpoint(r, indices_t());
+    }
+
+    const IProcess &get_process(uint_t rid) const { return *processes.at(rid); }
+
+    double propensity(uint_t rid) const {
+        double p = 0;
+        propensity(rid, p, indices_t());
+        return p;
+    }
+
+    void update_propensities(std::vector<double> &ps) const {
+        update_propensities(ps, indices_t());
+    }
+
+    void activate(uint_t rid, point_del_buf_t &removed, point_add_buf_t &added) {
+        activate(rid, removed, added, indices_t());
+    }
+
+    void notify_removal(Point &p) {
+        notify_removal(p, dependencies[p.get_entity()], indices_t());
+    }
+
+    void notify_add(Point &p) {
+        notify_add(p, dependencies[p.get_entity()], indices_t());
+    }
+
+    friend std::ostream &operator<< (std::ostream &os, const StaticModel &m) {
+        os << "StaticModel(entities=[" << join(", ", m.entities) << "]," << std::endl;
+        os << "      dependencies=[";
+        for(auto e : m.entities) {
+            os << e << " -> [";
+            bool first = true;
+            for(auto i = 0u; i<m.N; i++) {
+                if ((m.dependencies[e] >> i) & 1) {
+                    os << (first ? "" : ", ") << i;
+                    first = false;
+                }
+            }
+            os << "] ";
+        }
+        os << "]," << std::endl;
+
+        os << "      processes=["<<std::endl;
+        for(auto i = 0u; i<m.N; i++) {
+            auto &p = m.get_process(i);
+            os << "                ";
+            os << "#process " << i << " = " << p.info() << " -> " << p;
+            os << ", " << std::endl;
+        }
+        os << "])";
+        return os;
+    }
+private:
+    template<std::size_t... I>
+    void set_processes(index_sequence<I...>) {
+        processes = {{ &std::get<I>(*trackers).get_process()... }};
+    }
+
+    template<std::size_t... I>
+    StaticModel clone(index_sequence<I...>) const {
+        return StaticModel(std::get<I>(*trackers).get_typed_process()...);
+    }
+
+    template<std::size_t... I>
+    void copy_state_from(const StaticModel &o, index_sequence<I...>) {
+        PP_UNROLL(std::get<I>(*trackers).copy_state_from(std::get<I>(*o.trackers)));
+    }
+
+    template<std::size_t... I>
+    void write_checkpoint(CheckpointWriter &w, index_sequence<I...>) const {
+        PP_UNROLL(std::get<I>(*trackers).write_checkpoint(w));
+    }
+
+    template<std::size_t... I>
+    void read_checkpoint(CheckpointReader &r, index_sequence<I...>) {
+        PP_UNROLL(std::get<I>(*trackers).read_checkpoint(r));
+    }
+
+    template<std::size_t... I>
+    void initialise(SimulationState *s, index_sequence<I...>) {
+        PP_UNROLL(std::get<I>(*trackers).initialise(s));
+    }
+
+    template<std::size_t... I>
+    void propensity(uint_t rid, double &p, index_sequence<I...>) const {
+        PP_UNROLL(rid == I ? (p = std::get<I>(*trackers).propensity()) : 0);
+    }
+
+    template<std::size_t... I>
+    void update_propensities(std::vector<double> &ps, index_sequence<I...>) const {
+        PP_UNROLL(ps[I] = std::get<I>(*trackers).propensity());
+    }
+
+    template<std::size_t... I>
+    void activate(uint_t rid, point_del_buf_t &removed, point_add_buf_t &added, index_sequence<I...>) {
+        PP_UNROLL(rid == I ? (std::get<I>(*trackers).activate(removed, added), 0) : 0);
+    }
+
+    template<std::size_t... I>
+    void notify_removal(Point &p, uint64_t mask, index_sequence<I...>) {
+        PP_UNROLL((mask >> I) & 1 ? (std::get<I>(*trackers).notify_removal(p), 0) : 0);
+    }
+
+    template<std::size_t... I>
+    void notify_add(Point &p, uint64_t mask, index_sequence<I...>) {
+        PP_UNROLL((mask >> I) & 1 ? (std::get<I>(*trackers).notify_add(p), 0) : 0);
+    }
+
+    void update_entities(const IProcess &p) {
+        for(auto i = 0u; i<p.get_input_count(); i++) {
+            entities.insert(p.input(i));
+        }
+        for(auto i = 0u; i<p.get_output_count(); i++) {
+            entities.insert(p.output(i));
+        }
+    }
+
+    void compute_dependencies() {
+        dependencies = std::vector<uint64_t>(max_entity_id()+1, 0);
+        for(auto i = 0u; i<N; i++) {
+            for(auto j = 0u; j<processes[i]->get_input_count(); j++) {
+                dependencies[processes[i]->input(j)] |= uint64_t(1) << i;
+            }
+        }
+    }
+
+    std::shared_ptr<trackers_t> trackers; // tracker of each process
+    std::array<const IProcess*, N> processes; // process of each tracker
+    std::set<uint_t> entities; // list of entities
+    std::vector<uint64_t> dependencies; // entity -> bit mask of the processes that take it as input
+};
+
+template<typename... Ps>
+constexpr uint_t StaticModel<Ps...>::N;
+
+} // namespace
+
+#endif
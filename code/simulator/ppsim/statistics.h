@@ -0,0 +1,120 @@
+#ifndef __STATISTICS_H_
+#define __STATISTICS_H_
+
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+
+namespace pp {
+
+/* Standard normal quantile z such that P(-z < Z < z) = confidence */
+inline double normal_quantile(double confidence) {
+    if (!(confidence > 0 && confidence < 1)) {
+        throw std::runtime_error("Confidence level must be between 0 and 1");
+    }
+    /* bisection on the two-sided coverage erf(z/sqrt(2)) */
+    double lo = 0, hi = 40;
+    for(auto i = 0; i<100; i++) {
+        double z = (lo + hi)/2;
+        if (std::erf(z/std::sqrt(2.0)) < confidence) lo = z;
+        else hi = z;
+    }
+    return (lo + hi)/2;
+}
+
+/*
+ * Wilson score interval for a binomial proportion with the given successes out of n trials.
+ * Unlike the normal approximation it stays inside [0,1] and has a non-zero width when all or
+ * none of the trials succeed, so it can be used to stop sampling at probabilities near 0 or 1.
+ */
+inline std::pair<double, double> wilson_interval(unsigned long successes, unsigned long n, double z) {
+    if (n == 0) return std::make_pair(0.0, 1.0);
+    double p = double(successes)/n;
+    double z2 = z*z;
+    double centre = (p + z2/(2*n)) / (1 + z2/n);
+    double half = z * std::sqrt(p*(1-p)/n + z2/(4.0*n*n)) / (1 + z2/n);
+    return std::make_pair(std::max(0.0, centre - half), std::min(1.0, centre + half));
+}
+
+/*
+ * Logistic regression P(success | x) = 1/(1 + exp(-(a + b x))), e.g. of infection on log dose.
+ * The covariances are those of the inverse Fisher information at the estimate.
+ */
+struct LogisticFit {
+    double a = 0, b = 0;
+    double var_a = 0, cov_ab = 0, var_b = 0;
+    bool converged = false;
+
+    double probability(double x) const { return 1/(1 + std::exp(-(a + b*x))); }
+
+    /* x at which the probability is 1/2 (the ID50 on a dose axis) */
+    double median() const { return -a/b; }
+
+    /* Standard error of the median by the delta method */
+    double median_se() const {
+        double m = median();
+        return std::sqrt(std::max(0.0, var_a + 2*m*cov_ab + m*m*var_b)) / std::fabs(b);
+    }
+};
+
+/*
+ * Fit a logistic regression to the success fractions y[i] of w[i] trials at x[i] by Newton's
+ * method. The maximum likelihood estimate is infinite if the successes and failures are
+ * separated by some x, which is common with few trials or a sharp threshold; a normal prior
+ * N(0, slope_sd^2) on the slope (if slope_sd > 0) keeps the estimate finite (posterior mode).
+ */
+inline LogisticFit fit_logistic(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &w,
+                                double slope_sd = 0) {
+    double slope_precision = slope_sd > 0 ? 1/(slope_sd*slope_sd) : 0;
+    LogisticFit f;
+    auto log_likelihood = [&](double a, double b) {
+        double l = 0;
+        for(auto i = 0u; i<x.size(); i++) {
+            double eta = a + b*x[i];
+            /* log p = -log(1+exp(-eta)), log(1-p) = -log(1+exp(eta)) */
+            l -= w[i] * (y[i]*std::log1p(std::exp(-eta)) + (1-y[i])*std::log1p(std::exp(eta)));
+        }
+        return l - slope_precision*b*b/2;
+    };
+
+    double l = log_likelihood(f.a, f.b);
+    for(auto iteration = 0; iteration<100; iteration++) {
+        double ga = 0, gb = 0, haa = 0, hab = 0, hbb = 0;
+        for(auto i = 0u; i<x.size(); i++) {
+            double p = f.probability(x[i]);
+            double v = w[i]*p*(1-p);
+            ga += w[i]*(y[i] - p);
+            gb += w[i]*(y[i] - p)*x[i];
+            haa += v;
+            hab += v*x[i];
+            hbb += v*x[i]*x[i];
+        }
+        gb -= slope_precision*f.b;
+        hbb += slope_precision;
+        double det = haa*hbb - hab*hab;
+        if (!(det > 0)) break;
+        f.var_a = hbb/det;
+        f.cov_ab = -hab/det;
+        f.var_b = haa/det;
+
+        /* Newton step, halved until the likelihood does not decrease */
+        double da = f.var_a*ga + f.cov_ab*gb;
+        double db = f.cov_ab*ga + f.var_b*gb;
+        double step = 1;
+        while (step > 1e-6 && log_likelihood(f.a + step*da, f.b + step*db) < l - 1e-12) step /= 2;
+        f.a += step*da;
+        f.b += step*db;
+        l = log_likelihood(f.a, f.b);
+        if (std::fabs(step*da) + std::fabs(step*db) < 1e-9*(1 + std::fabs(f.a) + std::fabs(f.b))) {
+            f.converged = true;
+            break;
+        }
+    }
+    return f;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,119 @@
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <boost/align/aligned_allocator.hpp>
+
+#include "common.h"
+#include "accumulator.h"
+
+#ifndef __SUMTREE_H_
+#define __SUMTREE_H_
+
+namespace pp {
+
+/*
+ * B-ary sum tree with the same interface as Accumulator.
+ *
+ * Each node stores the inclusive prefix sums of its B children in a single cache line
+ * (B*sizeof(W) == 64 for the default B=8 and 64-bit W), so an increment or a search
+ * touches one line per level and the depth is log_B(codes) instead of log_2(codes).
+ * Within a node both operations are branchless loops over B entries that the compiler
+ * vectorises. Any number of codes is supported; only the last node of each level is padded.
+ */
+template<typename W, unsigned int B = 8>
+class SumTree {
+public:
+    static_assert(B >= 2, "SumTree needs at least two children per node");
+    using level_t = std::vector<W, boost::alignment::aligned_allocator<W, 64>>;
+
+    explicit SumTree(unsigned int c) : codes(c) {
+        assert(c > 0);
+        /* levels[0] holds the leaves; each further level has one entry per node of the level below */
+        unsigned int n = c;
+        do {
+            auto padded = ((n + B - 1) / B) * B;
+            levels.push_back(level_t(padded, 0));
+            n = padded / B;
+        } while (n > 1);
+        depth = levels.size();
+    }
+
+    void increment(unsigned int c, W weight) {
+        assert(c < codes);
+        for(auto &level : levels) {
+            W *node = &level[(c / B) * B];
+            unsigned int child = c % B;
+            for(unsigned int i = 0; i<B; i++) {
+                node[i] += (i >= child) ? weight : 0;
+            }
+            c /= B;
+        }
+    }
+
+    /* Same semantics as Accumulator::find_start_location */
+    std::pair<unsigned int, W> find_start_location(W weight_to_skip) const {
+        W remaining_weight = weight_to_skip;
+        unsigned int index = 0;
+        for(auto l = levels.size(); l-- > 0; ) {
+            const W *node = &levels[l][index * B];
+            /* first child whose inclusive prefix sum reaches the remaining weight */
+            unsigned int child = 0;
+            for(unsigned int i = 0; i<B; i++) {
+                child += (node[i] < remaining_weight);
+            }
+            if (child >= B) child = B-1; // only possible through rounding of non-integer weights
+            if (child > 0) remaining_weight -= node[child-1];
+            index = index * B + child;
+        }
+        assert(index < codes);
+        return std::pair<unsigned int, W>(index, remaining_weight);
+    }
+
+    inline W total() const {
+        const auto &top = levels.back();
+        return top[B-1];
+    }
+
+    /* Weight of each code */
+    inline const std::vector<W> leaves() const {
+        std::vector<W> vs(codes);
+        const auto &bottom = levels.front();
+        for(auto c = 0u; c<codes; c++) {
+            vs[c] = bottom[c] - ((c % B) ? bottom[c-1] : 0);
+        }
+        return vs;
+    }
+
+    inline const std::vector<level_t> &get_levels() const { return levels; }
+
+    const unsigned int codes; // total number of codes
+    unsigned int depth; // number of levels
+protected:
+    std::vector<level_t> levels;
+};
+
+template<typename W, unsigned int B>
+std::ostream &operator<< (std::ostream &os, const SumTree<W,B> &a) {
+    os << "SumTree(";
+    os << "codes=" << a.codes << " depth=" << a.depth << " arity=" << B << ")";
+    return os;
+}
+
+/*
+ * Weighted selection structure used by PointSet and ConfigurationSet.
+ * Set USE_SUMTREE to 0 to use the binary Accumulator instead.
+ */
+#ifndef USE_SUMTREE
+#define USE_SUMTREE 1
+#endif
+#if USE_SUMTREE
+template<typename W>
+using accumulator_t = SumTree<W>;
+#else
+template<typename W>
+using accumulator_t = Accumulator<W>;
+#endif
+
+} // namespace
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * Micro-benchmark: binary Accumulator vs. B-ary SumTree.
+ *
+ * Mimics the PointSet access pattern: a random increment/decrement pair
+ * (a point jumps between buckets) followed by a random selection.
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+
+#include "../common.h"
+#include "../accumulator.h"
+#include "../sumtree.h"
+
+template<typename A>
+double run(A &a, unsigned int codes, unsigned int points, unsigned int rounds, long &checksum) {
+    rng_t rng(12345);
+    std::uniform_int_distribution<unsigned int> code(0, codes-1);
+    std::vector<unsigned int> location(points);
+    for(auto i = 0u; i<points; i++) {
+        location[i] = code(rng);
+        a.increment(location[i], 1);
+    }
+    std::uniform_int_distribution<unsigned int> point(0, points-1);
+
+    auto start = std::chrono::steady_clock::now();
+    for(auto r = 0u; r<rounds; r++) {
+        auto i = point(rng);
+        a.increment(location[i], -1);
+        location[i] = code(rng);
+        a.increment(location[i], 1);
+        auto found = a.find_start_location(point(rng)+1);
+        checksum += found.first + found.second;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    return elapsed.count() * 1e9 / rounds;
+}
+
+int main() {
+    constexpr unsigned int rounds = 2000000;
+    std::cout << std::setw(10) << "codes" << std::setw(16) << "accumulator ns"
+              << std::setw(14) << "sumtree ns" << std::setw(14) << "sumtree16 ns" << std::endl;
+    for(unsigned int side : {10, 30, 60, 100, 300, 1000}) {
+        auto codes = side*side;
+        auto points = 2*codes;
+        long c1 = 0, c2 = 0, c3 = 0;
+
+        pp::Accumulator<long> a(codes);
+        auto ta = run(a, codes, points, rounds, c1);
+        pp::SumTree<long> t(codes);
+        auto tt = run(t, codes, points, rounds, c2);
+        pp::SumTree<long,16> t16(codes);
+        auto t16t = run(t16, codes, points, rounds, c3);
+
+        if (c1 != c2 || c1 != c3) {
+            std::cerr << "Checksum mismatch for " << codes << " codes" << std::endl;
+            return 1;
+        }
+        std::cout << std::setw(10) << codes << std::setw(16) << ta
+                  << std::setw(14) << tt << std::setw(14) << t16t << std::endl;
+    }
+    return 0;
+}
@@ -1,7 +1,12 @@
 #define CATCH_CONFIG_MAIN  
 #include "catch.hpp"
 
+#include <atomic>
+#include <future>
+
 #include "../pp.h"
+#include "json.hpp"
+#include "../../cases.h"
 
 /**
  * Some basic tests for the data structures 
@@ -44,6 +49,57 @@ TEST_CASE( "accumulator with a bucket for each node", "[accumulator]" ) {
     }
 }
 
+TEST_CASE( "sum tree agrees with the binary accumulator", "[sumtree]" ) {
+    /* Deliberately include code counts that are not powers of two (or of the arity) */
+    for(int codes : {1, 7, 8, 9, 63, 64, 65, 1000, 3600}) {
+        pp::Accumulator<long> a(codes);
+        pp::SumTree<long> t(codes);
+
+        for(int i = 0; i<codes; i++) {
+            a.increment(i, i % 3);
+            t.increment(i, i % 3);
+        }
+        for(int i = 0; i<codes; i += 2) {
+            a.increment(i, -(i % 3));
+            t.increment(i, -(i % 3));
+        }
+        REQUIRE( t.total() == a.total() );
+        REQUIRE( t.leaves().size() == codes );
+
+        for(long w = 1; w<=a.total(); w++) {
+            auto ra = a.find_start_location(w);
+            auto rt = t.find_start_location(w);
+            REQUIRE( rt.first == ra.first );
+            REQUIRE( rt.second == ra.second );
+        }
+    }
+}
+
+template<typename L>
+void check_layout_is_permutation(pp::uint_t row_length) {
+    L layout;
+    layout.resize(row_length);
+    std::vector<int> hits(row_length*row_length, 0);
+    for(auto y = 0u; y<row_length; y++) {
+        for(auto x = 0u; x<row_length; x++) {
+            auto i = layout.index(x, y);
+            REQUIRE(i < hits.size());
+            hits[i]++;
+        }
+    }
+    for(auto h : hits) {
+        REQUIRE(h == 1);
+    }
+}
+
+TEST_CASE( "cell layouts map cells one-to-one onto buckets", "[layout]" ) {
+    for(pp::uint_t row_length : {1, 2, 7, 16, 20, 33}) {
+        check_layout_is_permutation<pp::RowMajorLayout>(row_length);
+        check_layout_is_permutation<pp::MortonLayout>(row_length);
+        check_layout_is_permutation<pp::HilbertLayout>(row_length);
+    }
+}
+
 rng_t rng_instance;
 std::vector<double> random_values(double max, int n) {
     std::vector<double> vs;
@@ -72,8 +128,8 @@ TEST_CASE( "point set", "[pointset]" ) {
             auto x = xs[i];
             auto y = ys[i];
             auto *p = ps.new_point(x,y,POINT_TYPE);
-            REQUIRE((*p)[0] == x);
-            REQUIRE((*p)[1] == y);
+            REQUIRE((*p)[0] == pp::point_coord_t(x));
+            REQUIRE((*p)[1] == pp::point_coord_t(y));
             REQUIRE(p->get_entity() == POINT_TYPE);
             REQUIRE(!ps.contains(p));
             
@@ -106,6 +162,27 @@ TEST_CASE( "point set", "[pointset]" ) {
             }
         }
 
+        SECTION("Get nth after removals") {
+            /* Destroy every other point so that buckets get shuffled by swap-removes */
+            std::set<pp::Point*> remaining;
+            bool destroy = true;
+            for(auto p : points) {
+                if (destroy) ps.destroy_point(p);
+                else remaining.insert(p);
+                destroy = !destroy;
+            }
+            REQUIRE(ps.get_count() == remaining.size());
+
+            std::set<pp::Point*> found_points;
+            for(auto i = 0u; i<remaining.size(); i++) {
+                auto p = ps.get_nth(i);
+                REQUIRE(remaining.find(p) != remaining.end());
+                REQUIRE(ps.contains(p));
+                found_points.insert(p);
+            }
+            REQUIRE(found_points.size() == remaining.size());
+        }
+
         SECTION("Distance queries") {
             double distances[] = { 0.5, 1.0, 2, 3, 4, 10, 15, 20, 100 };
 
@@ -143,6 +220,1132 @@ TEST_CASE( "point set", "[pointset]" ) {
 }
 
 
+TEST_CASE( "distance queries reach every cell within the radius", "[pointset]" ) {
+    /* unit cells: radius 1.2 from near the right edge of a cell reaches two cells over */
+    for(auto ghost_radius : { 0.0, 2.0 }) {
+        pp::PointSet ps(10, 1, ghost_radius);
+        REQUIRE(ps.query_rings(1.2) == 2);
+        REQUIRE(int(1.2/1 + 0.5) == 1); // the old rounding
+        auto p = ps.new_point(4.9, 5.5, 1);
+        auto q = ps.new_point(6.05, 5.5, 1); // 1.15 away
+        ps.add(p);
+        ps.add(q);
+        pp::point_query_t buffer;
+        ps.get_within(p, 1.2, buffer);
+        REQUIRE(buffer.size() == 1);
+        REQUIRE(buffer[0] == q);
+    }
+
+    /* cells narrower than the bucket width: U = 20, bw = 3 gives 7 cells of width 20/7 */
+    pp::PointSet ps(20, 3);
+    REQUIRE(ps.query_rings(2.9) == 2);
+    REQUIRE(int(2.9/3 + 0.5) == 1); // the old rounding
+    auto p = ps.new_point(2.85, 1, 1);
+    auto q = ps.new_point(5.72, 1, 1); // 2.87 away, two cells over
+    ps.add(p);
+    ps.add(q);
+    pp::point_query_t buffer;
+    ps.get_within(p, 2.9, buffer);
+    REQUIRE(buffer.size() == 1);
+    REQUIRE(buffer[0] == q);
+}
+
+TEST_CASE( "point set with adaptive index for clustered points", "[pointset][quadtree]" ) {
+    double U = 20;
+    int N = 2000;
+    int POINT_TYPE = 1;
+
+    pp::PointSet ps(U, 1);
+    ps.set_max_occupancy(8);
+
+    /* Put all points into a small disk so that a few cells get crowded */
+    auto rs = random_values(1, N);
+    auto ts = random_values(2*M_PI, N);
+    std::vector<pp::Point*> points;
+    for(auto i = 0; i<N; i++) {
+        auto p = ps.new_point(10 + 1.5*sqrt(rs[i])*cos(ts[i]), 10 + 1.5*sqrt(rs[i])*sin(ts[i]), POINT_TYPE);
+        ps.add(p);
+        points.push_back(p);
+    }
+
+    /* Remove a third of the points so that some trees shrink */
+    std::vector<pp::Point*> remaining;
+    for(auto i = 0u; i<points.size(); i++) {
+        if (i % 3 == 0) ps.destroy_point(points[i]);
+        else remaining.push_back(points[i]);
+    }
+    REQUIRE(ps.get_count() == remaining.size());
+
+    for(auto d : { 0.1, 0.5, 1.0, 3.0 }) {
+        for(auto p : remaining) {
+            pp::point_query_t buffer;
+            ps.get_within(p, d, buffer);
+            std::set<pp::Point*> found(buffer.begin(), buffer.end());
+            REQUIRE(found.size() == buffer.size());
+
+            pp::uint_t expected = 0;
+            for(auto q : remaining) {
+                if (p != q && p->torus_squared_distance(*q, U) <= d*d) {
+                    expected++;
+                    REQUIRE(found.count(q) == 1);
+                }
+            }
+            REQUIRE(buffer.size() == expected);
+        }
+    }
+}
+
+TEST_CASE( "point set with ghost cells", "[pointset][ghost]" ) {
+    double U = 20;
+    int N = 1000;
+    int POINT_TYPE = 1;
+
+    pp::PointSet ps(U, 1, 3);
+
+    auto xs = random_values(U, N);
+    auto ys = random_values(U, N);
+    std::vector<pp::Point*> points;
+    for(auto i = 0; i<N; i++) {
+        auto p = ps.new_point(xs[i], ys[i], POINT_TYPE);
+        ps.add(p);
+        points.push_back(p);
+    }
+
+    /* Removals must also clear the mirrored copies */
+    std::vector<pp::Point*> remaining;
+    for(auto i = 0u; i<points.size(); i++) {
+        if (i % 4 == 0) ps.destroy_point(points[i]);
+        else remaining.push_back(points[i]);
+    }
+    REQUIRE(ps.get_count() == remaining.size());
+
+    /* Distances both within and beyond the ghost radius */
+    for(auto d : { 0.5, 1.0, 2.5, 3.0, 5.0 }) {
+        for(auto p : remaining) {
+            pp::point_query_t buffer;
+            ps.get_within(p, d, buffer);
+            std::set<pp::Point*> found(buffer.begin(), buffer.end());
+            REQUIRE(found.size() == buffer.size());
+
+            pp::uint_t expected = 0;
+            for(auto q : remaining) {
+                if (p != q && p->torus_squared_distance(*q, U) <= d*d) {
+                    expected++;
+                    REQUIRE(found.count(q) == 1);
+                }
+            }
+            REQUIRE(buffer.size() == expected);
+        }
+    }
+}
+
+/* Fraction of samples per bin of squared radius and of angle; both are uniform for a uniform disk */
+template<typename F>
+void check_disk_distribution(F sample, double radius, int n) {
+    constexpr int bins = 16;
+    std::vector<int> radial(bins, 0), angular(bins, 0);
+    for(auto i = 0; i<n; i++) {
+        auto c = sample();
+        auto rr = (c[0]*c[0] + c[1]*c[1]) / (radius*radius);
+        REQUIRE(rr < 1);
+        auto t = atan2(c[1], c[0]) + M_PI;
+        radial[std::min(int(rr*bins), bins-1)]++;
+        angular[std::min(int(t/(2*M_PI)*bins), bins-1)]++;
+    }
+    /* each bin count is binomial(n, 1/bins); allow five standard deviations */
+    double expected = double(n)/bins;
+    double tolerance = 5*sqrt(expected*(1 - 1.0/bins));
+    for(auto b = 0; b<bins; b++) {
+        REQUIRE(fabs(radial[b] - expected) < tolerance);
+        REQUIRE(fabs(angular[b] - expected) < tolerance);
+    }
+}
+
+TEST_CASE( "tophat samples are uniform on the disk", "[kernel]" ) {
+    pp::Tophat k(1.0, 2.5);
+    pp::RandomSource g;
+    constexpr int n = 200000;
+    check_disk_distribution([&k, &g]() { return k.sample(g); }, k.radius, n);
+    check_disk_distribution([&k, &g]() { return k.sample_polar(g); }, k.radius, n);
+}
+
+TEST_CASE( "random source", "[random]" ) {
+    pp::RandomSource g;
+    int seed = 42;
+    g.seed(seed);
+    constexpr int n = 1000000;
+
+    SECTION("Uniform values are in [0,1) and reseeding repeats the stream") {
+        std::vector<double> first;
+        for(auto i = 0; i<1000; i++) {
+            auto u = g.uniform();
+            REQUIRE(u >= 0);
+            REQUIRE(u < 1);
+            first.push_back(u);
+        }
+        g.seed(seed);
+        for(auto u : first) {
+            REQUIRE(g.uniform() == u);
+        }
+    }
+
+    SECTION("Exponential values follow the exponential distribution") {
+        /* tail probabilities P(X > t) = exp(-t), including t beyond the ziggurat base */
+        std::vector<double> ts = { 0.01, 0.1, 0.5, 1, 2, 4, 7, 7.7, 9 };
+        std::vector<int> above(ts.size(), 0);
+        double sum = 0;
+        for(auto i = 0; i<n; i++) {
+            auto x = g.exponential();
+            REQUIRE(x >= 0);
+            sum += x;
+            for(auto j = 0u; j<ts.size(); j++) {
+                above[j] += (x > ts[j]);
+            }
+        }
+        REQUIRE(fabs(sum/n - 1) < 5/sqrt(double(n)));
+        for(auto j = 0u; j<ts.size(); j++) {
+            auto p = exp(-ts[j]);
+            REQUIRE(fabs(above[j] - n*p) < 5*sqrt(n*p*(1-p)) + 1);
+        }
+    }
+}
+
+TEST_CASE( "random streams", "[random]" ) {
+    uint64_t master = 1234;
+    std::vector<pp::StreamId> ids = { {0,0}, {0,1}, {1,0}, {1,1}, {0,0,1,0}, {0,0,0,1} };
+
+    /* Each stream is reproducible and starts differently from the others */
+    std::set<double> firsts;
+    for(const auto &id : ids) {
+        pp::RandomSource a, b;
+        a.seed_stream(master, id);
+        b.seed_stream(master, id);
+        auto first = a.uniform();
+        REQUIRE(first == b.uniform());
+        for(auto i = 0; i<1000; i++) {
+            REQUIRE(a.uniform() == b.uniform());
+        }
+        firsts.insert(first);
+    }
+    REQUIRE(firsts.size() == ids.size());
+
+    /* Tiles are consecutive blocks of 2^64 draws of the same stream */
+    pp::RandomSource base, tile;
+    base.seed_stream(master, pp::StreamId(3, 5, 0, 0));
+    tile.seed_stream(master, pp::StreamId(3, 5, 0, 1));
+    base.get_engine().advance(pcg_extras::pcg128_t(1) << 64);
+    for(auto i = 0; i<100; i++) {
+        REQUIRE(base.get_engine()() == tile.get_engine()());
+    }
+}
+
+template<typename S>
+std::vector<pp::uint_t> run_small_model(S &sim) {
+    int seed = 7;
+    sim.set_seed(seed);
+    sim.fill(1, 0.5);
+    sim.fill(2, 0.5);
+    sim.run(5);
+    auto counts = sim.get_state().stats.number_of_events;
+    for(auto e = 1; e<=3; e++) {
+        counts.push_back(sim.get_state().get_count(e));
+    }
+    return counts;
+}
+
+TEST_CASE( "static and runtime models give the same simulation", "[model]" ) {
+    using pp::Tophat;
+    auto jump = pp::Jump<Tophat>(1, 1.0, 1.0);
+    auto birth = pp::Birth<Tophat>(1, 3, 0.2, 1.0);
+    auto facilitation = pp::ChangeInTypeByFacilitation<Tophat>(2, 1, 3, 0.5, 1.5);
+    auto death = pp::DensityIndependentDeath(3, 0.3);
+
+    pp::Model m;
+    m += jump;
+    m += birth;
+    m += facilitation;
+    m += death;
+    m.done();
+    pp::Simulator runtime(10, m);
+
+    using static_model_t = pp::StaticModel<decltype(jump), decltype(birth), decltype(facilitation), decltype(death)>;
+    pp::BasicSimulator<static_model_t> compiled(10, static_model_t(jump, birth, facilitation, death));
+
+    REQUIRE(compiled.get_model().process_count() == m.process_count());
+    REQUIRE(compiled.get_model().max_entity_id() == m.max_entity_id());
+
+    auto a = run_small_model(runtime);
+    auto b = run_small_model(compiled);
+    REQUIRE(a == b);
+    REQUIRE(runtime.get_state().stats.time == compiled.get_state().stats.time);
+}
+
+TEST_CASE( "model clones run in parallel on a thread pool", "[model][threads]" ) {
+    using pp::Tophat;
+    auto jump = pp::Jump<Tophat>(1, 1.0, 1.0);
+    auto birth = pp::Birth<Tophat>(1, 3, 0.2, 1.0);
+    auto facilitation = pp::ChangeInTypeByFacilitation<Tophat>(2, 1, 3, 0.5, 1.5);
+    auto death = pp::DensityIndependentDeath(3, 0.3);
+
+    pp::Model m;
+    m += jump;
+    m += birth;
+    m += facilitation;
+    m += death;
+    m.done();
+    using static_model_t = pp::StaticModel<decltype(jump), decltype(birth), decltype(facilitation), decltype(death)>;
+    static_model_t sm(jump, birth, facilitation, death);
+
+    pp::Simulator reference(10, m.clone());
+    auto expected = run_small_model(reference);
+
+    /* clones have their own trackers, so simulations of the same model can run concurrently */
+    const int N = 6;
+    std::vector<std::vector<pp::uint_t>> runtime(N), compiled(N);
+    {
+        pp::ThreadPool pool(3);
+        REQUIRE(pool.size() == 3);
+        for(auto i = 0; i<N; i++) {
+            pool.submit([&, i]() {
+                pp::Simulator s(10, m.clone());
+                runtime[i] = run_small_model(s);
+            });
+            pool.submit([&, i]() {
+                pp::BasicSimulator<static_model_t> s(10, sm.clone());
+                compiled[i] = run_small_model(s);
+            });
+        }
+        pool.wait();
+    }
+    for(auto i = 0; i<N; i++) {
+        REQUIRE(runtime[i] == expected);
+        REQUIRE(compiled[i] == expected);
+    }
+
+    /* the first exception of a task is rethrown by wait and the queued tasks are dropped */
+    pp::ThreadPool pool(1);
+    std::atomic<int> done(0);
+    std::promise<void> queued;
+    auto all_queued = queued.get_future().share();
+    pool.submit([all_queued]() { all_queued.wait(); throw std::runtime_error("task failed"); });
+    for(auto i = 0; i<10; i++) pool.submit([&]() { done++; });
+    queued.set_value();
+    REQUIRE_THROWS(pool.wait());
+    REQUIRE(done == 0);
+    pool.submit([&]() { done = 100; });
+    pool.wait();
+    REQUIRE(done == 100);
+
+    /* the most expensive tasks run first */
+    std::vector<int> order;
+    std::promise<void> submitted;
+    auto all_submitted = submitted.get_future().share();
+    pool.submit([all_submitted]() { all_submitted.wait(); }, 100);
+    for(auto cost : { 3, 1, 4, 2 }) {
+        pool.submit([&order, cost]() { order.push_back(cost); }, cost);
+    }
+    submitted.set_value();
+    pool.wait();
+    REQUIRE(order == std::vector<int>({ 4, 3, 2, 1 }));
+
+    /* an idle worker steals the queued tasks of a busy one */
+    pp::ThreadPool pair(2);
+    std::atomic<int> finished(0);
+    std::promise<void> ready;
+    auto all_ready = ready.get_future().share();
+    pair.submit([&, all_ready]() { all_ready.wait(); std::this_thread::sleep_for(std::chrono::milliseconds(300)); finished++; }, 1);
+    for(auto i = 0; i<7; i++) {
+        pair.submit([&, all_ready]() { all_ready.wait(); finished++; }, 1);
+    }
+    ready.set_value();
+    pair.wait();
+    REQUIRE(finished == 8);
+    REQUIRE(pair.get_steals() > 0);
+}
+
+/* Clustered start with quadtrees (and ghost cells of radius 1.5 with USE_GHOST_CELLS=1) and an extinction condition */
+template<typename S>
+void setup_small_model(S &sim) {
+    int seed = 11;
+    sim.set_seed(seed);
+    sim.set_max_cell_occupancy(2, 2);
+    sim.fill(1, 0.5);
+    sim.fill_circle(2, sim.get_state().center(), pp::Tophat(0.5, 2));
+    sim.add_halting_condition(pp::CheckExtinction(2));
+}
+
+template<typename S>
+std::vector<pp::uint_t> outcome(const S &sim) {
+    auto counts = sim.get_state().stats.number_of_events;
+    for(auto e = 1; e<=3; e++) {
+        counts.push_back(sim.get_state().get_count(e));
+    }
+    return counts;
+}
+
+template<typename M>
+void check_copied_states(const M &m) {
+    pp::BasicSimulator<M> reference(10, m.clone());
+    setup_small_model(reference);
+    reference.run(5);
+    auto expected = outcome(reference);
+
+    pp::BasicSimulator<M> prototype(10, m.clone());
+    setup_small_model(prototype);
+
+    /* a copy continues exactly like the original, and leaves the original untouched */
+    pp::BasicSimulator<M> copy(10, m.clone());
+    copy.copy_state_from(prototype);
+    REQUIRE(copy.get_state().get_count() == prototype.get_state().get_count());
+    copy.run(5);
+    REQUIRE(outcome(copy) == expected);
+    REQUIRE(copy.get_halt_reason() == reference.get_halt_reason());
+    prototype.run(5);
+    REQUIRE(outcome(prototype) == expected);
+
+    /* reseeded copies of the same state follow their own streams */
+    pp::BasicSimulator<M> fresh(10, m.clone());
+    setup_small_model(fresh);
+    std::vector<std::vector<pp::uint_t>> runs;
+    for(auto replicate = 0u; replicate<3; replicate++) {
+        pp::BasicSimulator<M> s(10, m.clone());
+        s.copy_state_from(fresh);
+        s.set_stream(42, pp::StreamId(1, replicate % 2));
+        s.run(5);
+        runs.push_back(outcome(s));
+    }
+    REQUIRE(runs[0] == runs[2]);
+    REQUIRE(runs[0] != runs[1]);
+
+    REQUIRE_THROWS(prototype.copy_state_from(fresh));
+}
+
+TEST_CASE( "simulations continue identically from a copied state", "[model][copy]" ) {
+    using pp::Tophat;
+    auto jump = pp::Jump<Tophat>(1, 1.0, 1.0);
+    auto birth = pp::Birth<Tophat>(1, 3, 0.2, 1.0);
+    auto facilitation = pp::ChangeInTypeByFacilitation<Tophat>(2, 1, 3, 0.5, 1.5);
+    auto death = pp::DensityIndependentDeath(3, 0.3);
+
+    pp::Model m;
+    m += jump;
+    m += birth;
+    m += facilitation;
+    m += death;
+    m.done();
+    check_copied_states(m);
+
+    using static_model_t = pp::StaticModel<decltype(jump), decltype(birth), decltype(facilitation), decltype(death)>;
+    check_copied_states(static_model_t(jump, birth, facilitation, death));
+}
+
+/* Density and summary output of a run of the small model, optionally stopped at a checkpoint */
+template<typename S>
+void add_small_model_writers(S &sim, std::shared_ptr<std::ostringstream> density, std::shared_ptr<std::ostringstream> summary) {
+    sim.template make_writer<pp::DensityWriter>(density, 0.5);
+    sim.template make_writer<pp::SummaryWriter>(summary, std::vector<std::pair<pp::uint_t, std::string>>{ {1, "one"}, {2, "two"} });
+}
+
+template<typename M>
+void check_checkpoints(const M &m) {
+    auto density = std::make_shared<std::ostringstream>(), summary = std::make_shared<std::ostringstream>();
+    pp::BasicSimulator<M> reference(10, m.clone());
+    setup_small_model(reference);
+    add_small_model_writers(reference, density, summary);
+    reference.run(5);
+    REQUIRE(reference.get_state().stats.time > 2);
+
+    /* checkpoints between events leave the trajectory as it is */
+    pp::BasicSimulator<M> checkpointed(10, m.clone());
+    setup_small_model(checkpointed);
+    int checkpoints = 0;
+    checkpointed.set_checkpointing([&]() { checkpoints++; return false; }, 1);
+    checkpointed.run(5);
+    REQUIRE(checkpoints >= 2);
+    REQUIRE(outcome(checkpointed) == outcome(reference));
+
+    /* a run stopped at a checkpoint and restored elsewhere continues bit for bit */
+    auto density1 = std::make_shared<std::ostringstream>(), summary1 = std::make_shared<std::ostringstream>();
+    pp::BasicSimulator<M> first(10, m.clone());
+    setup_small_model(first);
+    add_small_model_writers(first, density1, summary1);
+    std::stringstream checkpoint;
+    std::string density_so_far;
+    volatile sig_atomic_t request = 0;
+    first.set_checkpointing([&]() {
+        pp::CheckpointWriter w(checkpoint);
+        w.header();
+        first.write_checkpoint(w);
+        density_so_far = density1->str();
+        return true;
+    }, 2, &request);
+    first.run(5);
+    REQUIRE(first.get_halt_reason() == "Stopped after writing a checkpoint.");
+    REQUIRE(first.get_state().stats.time < reference.get_state().stats.time);
+
+    auto density2 = std::make_shared<std::ostringstream>(), summary2 = std::make_shared<std::ostringstream>();
+    *density2 << density_so_far;
+    pp::BasicSimulator<M> second(10, m.clone());
+    setup_small_model(second);
+    add_small_model_writers(second, density2, summary2);
+    pp::CheckpointReader r(checkpoint);
+    r.header();
+    second.read_checkpoint(r);
+    REQUIRE(second.get_state().stats.time == first.get_state().stats.time);
+    second.resume();
+    REQUIRE(outcome(second) == outcome(reference));
+    REQUIRE(second.get_state().stats.time == reference.get_state().stats.time);
+    REQUIRE(second.get_halt_reason() == reference.get_halt_reason());
+    REQUIRE(density2->str() == density->str());
+    REQUIRE(summary2->str() == summary->str());
+
+    /* requested checkpoints clear the request */
+    pp::BasicSimulator<M> requested(10, m.clone());
+    setup_small_model(requested);
+    request = 1;
+    checkpoints = 0;
+    requested.set_checkpointing([&]() { checkpoints++; return false; }, 0, &request);
+    requested.run(5);
+    REQUIRE(checkpoints == 1);
+    REQUIRE(request == 0);
+
+    /* checkpoints of other simulations are refused */
+    std::stringstream garbage("not a checkpoint");
+    pp::CheckpointReader bad(garbage);
+    REQUIRE_THROWS(bad.header());
+    pp::BasicSimulator<M> other(12, m.clone());
+    std::stringstream again;
+    pp::CheckpointWriter w(again);
+    reference.write_checkpoint(w);
+    pp::CheckpointReader mismatch(again);
+    REQUIRE_THROWS(other.read_checkpoint(mismatch));
+}
+
+TEST_CASE( "checkpoints restore a run exactly", "[simulator][checkpoint]" ) {
+    using pp::Tophat;
+    auto jump = pp::Jump<Tophat>(1, 1.0, 1.0);
+    auto birth = pp::Birth<Tophat>(1, 3, 0.2, 1.0);
+    auto facilitation = pp::ChangeInTypeByFacilitation<Tophat>(2, 1, 3, 0.5, 1.5);
+    auto death = pp::DensityIndependentDeath(3, 0.3);
+
+    pp::Model m;
+    m += jump;
+    m += birth;
+    m += facilitation;
+    m += death;
+    m.done();
+    check_checkpoints(m);
+
+    using static_model_t = pp::StaticModel<decltype(jump), decltype(birth), decltype(facilitation), decltype(death)>;
+    check_checkpoints(static_model_t(jump, birth, facilitation, death));
+}
+
+TEST_CASE( "multilevel splitting estimates rare survival probabilities", "[splitting]" ) {
+    /* subcritical birth-death process from a single point */
+    pp::Model m;
+    m += pp::Birth<pp::Tophat>(1, 1, 0.5, 1.0);
+    m += pp::DensityIndependentDeath(1, 1.0);
+    m.done();
+
+    pp::SplittingSettings settings;
+    settings.entity = 1;
+    settings.outcome_entity = 1;
+    settings.time = 5;
+
+    pp::ThreadPool pool(2);
+    auto estimate = [&](uint32_t repetition) {
+        auto start = [&, repetition](uint32_t k) {
+            auto s = std::make_shared<pp::Simulator>(10, m.clone());
+            s->set_stream(1, pp::StreamId(1, repetition, 0, k));
+            s->add_new_point(s->get_state().center(), 1);
+            return s;
+        };
+        auto reseed = [repetition](pp::Simulator &s, uint32_t stage, uint32_t k) {
+            s.set_stream(1, pp::StreamId(1, repetition, stage, k));
+        };
+        return pp::multilevel_splitting<pp::Model>(settings, start, reseed, pool);
+    };
+
+    /* without levels it is plain Monte Carlo */
+    settings.trajectories = 4000;
+    auto plain = estimate(1000);
+    REQUIRE(plain.crossed.empty());
+    REQUIRE(plain.segments == settings.trajectories);
+    REQUIRE(plain.probability == Approx(double(plain.succeeded)/settings.trajectories));
+    double plain_var = plain.probability*(1 - plain.probability)/settings.trajectories;
+
+    settings.levels = { 3, 6 };
+    settings.trajectories = 100;
+    const int R = 20;
+    double sum = 0, sum2 = 0;
+    for(auto r = 0; r<R; r++) {
+        auto result = estimate(r);
+        REQUIRE(result.crossed.size() == 2);
+        REQUIRE(result.crossed[0] <= settings.trajectories);
+        REQUIRE(result.probability >= 0);
+        REQUIRE(result.probability <= 1);
+        sum += result.probability;
+        sum2 += result.probability*result.probability;
+    }
+    double mean = sum/R, var = (sum2/R - mean*mean)/(R - 1);
+    REQUIRE(std::fabs(mean - plain.probability) < 4*std::sqrt(var + plain_var));
+
+    /* the same streams give the same estimate */
+    REQUIRE(estimate(3).probability == estimate(3).probability);
+
+    settings.levels = { 6, 3 };
+    REQUIRE_THROWS(estimate(0));
+    settings.levels = { 3 };
+    settings.trajectories = 0;
+    REQUIRE_THROWS(estimate(0));
+}
+
+TEST_CASE( "halting conditions", "[simulator]" ) {
+    pp::Model m;
+    m += pp::DensityIndependentDeath(1, 1.0);
+    m += pp::Jump<pp::Tophat>(2, 1.0, 1.0);
+    m.done();
+    pp::Simulator sim(10, m);
+    int seed = 3;
+    sim.set_seed(seed);
+    sim.fill(1, 0.2);
+    sim.fill(2, 0.2);
+    auto initial = sim.get_state().get_count(1);
+
+    SECTION("Extinction is detected at the event that removes the last point") {
+        sim.add_time_halting_condition(1000);
+        sim.add_halting_condition(pp::CheckExtinction(1));
+        sim.run(2000);
+        REQUIRE(sim.get_halt_reason() == "Halting condition #1 triggered");
+        REQUIRE(sim.get_state().get_count(1) == 0);
+        REQUIRE(sim.get_state().stats.number_of_events[0] == initial);
+        REQUIRE(sim.get_state().stats.time < 1000);
+    }
+
+    SECTION("Time conditions halt at the first event past the time") {
+        sim.add_halting_condition(pp::CheckExtinction(1));
+        sim.add_time_halting_condition(0.5);
+        sim.run(2000);
+        REQUIRE(sim.get_halt_reason() == "Halting condition #1 triggered");
+        REQUIRE(sim.get_state().stats.time >= 0.5);
+        REQUIRE(sim.get_state().get_count(1) > 0);
+    }
+
+    SECTION("Polled conditions and conditions true at the start") {
+        sim.add_halting_condition([](const pp::SimulationState &s) { return s.stats.total_events >= 10; });
+        sim.run(2000);
+        REQUIRE(sim.get_halt_reason() == "Halting condition #0 triggered");
+        REQUIRE(sim.get_state().stats.total_events == 10);
+
+    }
+
+    SECTION("Conditions that hold initially halt before the first event") {
+        sim.add_entity_halting_condition(2, [](const pp::SimulationState &s) { return s.get_count(2) > 0; });
+        sim.run(2000);
+        REQUIRE(sim.get_halt_reason() == "Halting condition #0 triggered");
+        REQUIRE(sim.get_state().stats.total_events == 0);
+    }
+}
+
+struct RecordingWriter : public pp::Writer {
+    RecordingWriter(double d) : pp::Writer(d) {}
+    void write(pp::SimulationState &s, double t) { 
+        times.push_back(t); 
+        state_times.push_back(s.stats.time); 
+    }
+    void start(pp::SimulationState &s) {}
+    void end(pp::SimulationState &s) {}
+
+    std::vector<double> times; // requested grid times
+    std::vector<double> state_times; // time of the last event before each write
+};
+
+TEST_CASE( "writers are called at grid times", "[simulator][writers]" ) {
+    pp::Model m;
+    m += pp::Jump<pp::Tophat>(1, 0.1, 1.0);
+    m.done();
+    pp::Simulator sim(10, m);
+    int seed = 5;
+    sim.set_seed(seed);
+    sim.fill(1, 0.2);
+
+    double delta = 0.25, T = 20;
+    sim.make_writer<RecordingWriter>(delta);
+    sim.run(T);
+    auto &w = dynamic_cast<RecordingWriter&>(*sim.writers[0]);
+
+    /* every grid time up to T exactly once, each seeing the state before it */
+    REQUIRE(w.times.size() == size_t(T/delta));
+    for(auto k = 0u; k<w.times.size(); k++) {
+        REQUIRE(w.times[k] == (k+1)*delta);
+        REQUIRE(w.state_times[k] <= w.times[k]);
+    }
+}
+
+TEST_CASE( "asynchronous writers give the same output", "[writers]" ) {
+    pp::Model m;
+    m += pp::Jump<pp::Tophat>(1, 1.0, 1.0);
+    m += pp::DensityIndependentDeath(1, 0.05);
+    m.done();
+
+    auto sync_snapshots = std::make_shared<std::stringstream>();
+    auto sync_density = std::make_shared<std::stringstream>();
+    auto async_snapshots = std::make_shared<std::stringstream>();
+    auto async_density = std::make_shared<std::stringstream>();
+    int seed = 11;
+    {
+        pp::Simulator sim(10, m);
+        sim.set_seed(seed);
+        sim.fill(1, 1.0);
+        sim.make_writer<pp::SnapshotWriter>(sync_snapshots, 0.5);
+        sim.make_writer<pp::DensityWriter>(sync_density, 0.5);
+        sim.run(10);
+    }
+    pp::Model m2;
+    m2 += pp::Jump<pp::Tophat>(1, 1.0, 1.0);
+    m2 += pp::DensityIndependentDeath(1, 0.05);
+    m2.done();
+    {
+        pp::Simulator sim(10, m2);
+        sim.set_seed(seed);
+        sim.fill(1, 1.0);
+        /* a single buffer forces the simulation to wait for the output thread */
+        auto &ws = sim.make_writer<pp::AsyncWriter<pp::SnapshotFormat>>(async_snapshots, 0.5, 1);
+        auto &wd = sim.make_writer<pp::AsyncWriter<pp::DensityFormat>>(async_density, 0.5);
+        sim.run(10);
+        REQUIRE(ws.get_stall_stats().snapshots == 22);
+        REQUIRE(wd.get_stall_stats().snapshots == 22);
+    }
+    REQUIRE(async_snapshots->str() == sync_snapshots->str());
+    REQUIRE(async_density->str() == sync_density->str());
+}
+
+TEST_CASE( "binary snapshots can be read back", "[writers][binary]" ) {
+    pp::Model m;
+    m += pp::Jump<pp::Tophat>(1, 1.0, 1.0);
+    m += pp::Birth<pp::Tophat>(1, 2, 0.1, 1.0);
+    m.done();
+
+    for(bool double_precision : { false, true }) {
+        std::string fname = "binary_snapshot_test.bin";
+        pp::Simulator sim(10, m);
+        int seed = 13;
+        sim.set_seed(seed);
+        sim.fill(1, 0.5);
+        {
+            auto out = std::make_shared<std::fstream>(fname, std::ios::out | std::ios::binary);
+            sim.make_writer<pp::FormatWriter<pp::BinarySnapshotFormat>>(out, 1.0, pp::BinarySnapshotFormat(double_precision));
+            sim.run(5);
+        }
+        pp::BinarySnapshotReader reader(fname);
+        REQUIRE(reader.frames() == 7); // start, 5 grid times, end
+        REQUIRE(reader.entities() == 3);
+        REQUIRE(reader.coord_bytes() == (double_precision ? 8u : 4u));
+        REQUIRE(reader.U() == 10);
+
+        /* the last frame is the final state */
+        auto f = reader.frame(reader.frames()-1);
+        auto &state = const_cast<pp::SimulationState&>(sim.get_state());
+        REQUIRE(f.time() == state.stats.time);
+        REQUIRE(f.events() == state.stats.total_events);
+        /* single precision coordinates are compared as floats: a rounding through a double can be optimised away */
+        std::multiset<std::pair<double,double>> expected[3], found[3];
+        std::multiset<std::pair<float,float>> expected_single[3], found_single[3];
+        for(auto p : state.enumerate()) {
+            auto x = (*p)[0], y = (*p)[1];
+            if (double_precision) {
+                expected[p->get_entity()].insert(std::make_pair(x, y));
+            } else {
+                expected_single[p->get_entity()].insert(std::make_pair(float(x), float(y)));
+            }
+        }
+        for(auto e = 0u; e<3; e++) {
+            REQUIRE(f.count(e) == state.get_count(e));
+            for(auto i = 0u; i<f.count(e); i++) {
+                if (double_precision) {
+                    found[e].insert(std::make_pair(f.xs<double>(e)[i], f.ys<double>(e)[i]));
+                } else {
+                    found_single[e].insert(std::make_pair(f.xs<float>(e)[i], f.ys<float>(e)[i]));
+                }
+            }
+            REQUIRE(found[e] == expected[e]);
+            REQUIRE(found_single[e] == expected_single[e]);
+        }
+        std::remove(fname.c_str());
+    }
+}
+
+/* Records the quantized state at each grid time */
+struct QuantizedRecorder : public pp::Writer {
+    using state_t = std::vector<std::tuple<pp::uint_t, uint64_t, uint64_t>>;
+
+    QuantizedRecorder(double d, pp::CoordQuantizer q) : pp::Writer(d), quantizer(q) {}
+
+    void write(pp::SimulationState &s, double t) {
+        state_t state;
+        for(auto p : s.enumerate()) {
+            state.push_back(std::make_tuple(p->get_entity(), quantizer.quantize((*p)[0]), quantizer.quantize((*p)[1])));
+        }
+        std::sort(state.begin(), state.end());
+        times.push_back(t);
+        events.push_back(s.stats.total_events);
+        states.push_back(state);
+    }
+    void start(pp::SimulationState &s) {}
+    void end(pp::SimulationState &s) {}
+
+    pp::CoordQuantizer quantizer;
+    std::vector<double> times;
+    std::vector<pp::uint_t> events;
+    std::vector<state_t> states;
+};
+
+QuantizedRecorder::state_t logged_state(const pp::EventLogReader &reader) {
+    QuantizedRecorder::state_t state;
+    for(auto &p : reader.points()) {
+        state.push_back(std::make_tuple(p.second.entity, p.second.qx, p.second.qy));
+    }
+    std::sort(state.begin(), state.end());
+    return state;
+}
+
+TEST_CASE( "event log reproduces the trajectory", "[writers][event log]" ) {
+    pp::Model m;
+    m += pp::Jump<pp::Tophat>(1, 1.0, 1.0);
+    m += pp::Birth<pp::Tophat>(1, 2, 0.1, 1.0);
+    m += pp::ChangeInType(2, 1, 0.2);
+    m += pp::DensityIndependentDeath(1, 0.05);
+    m.done();
+
+    double U = 10;
+    pp::Simulator sim(U, m);
+    int seed = 17;
+    sim.set_seed(seed);
+    sim.fill(1, 0.5);
+    auto out = std::make_shared<std::stringstream>();
+    sim.make_writer<pp::EventLogWriter>(out, 2.0);
+    sim.make_writer<QuantizedRecorder>(0.25, pp::CoordQuantizer(U, 24));
+    sim.run(8);
+    auto &recorder = dynamic_cast<QuantizedRecorder&>(*sim.writers[1]);
+    REQUIRE(recorder.times.size() == 32);
+
+    SECTION( "replaying in order" ) {
+        pp::EventLogReader reader(*out);
+        REQUIRE(reader.U() == U);
+        REQUIRE(reader.keyframes().size() == 5); // start and t = 2, 4, 6, 8
+        for(auto i = 0u; i<recorder.times.size(); i++) {
+            reader.advance_to(recorder.times[i]);
+            REQUIRE(reader.events() == recorder.events[i]);
+            REQUIRE(logged_state(reader) == recorder.states[i]);
+        }
+        while (reader.next()) {}
+        REQUIRE(reader.finished());
+        REQUIRE(reader.events() == sim.get_state().stats.total_events);
+        REQUIRE(reader.time() == sim.get_state().stats.time);
+        for(auto e = 0u; e<reader.entities(); e++) {
+            REQUIRE(reader.get_count(e) == sim.get_state().get_count(e));
+        }
+    }
+
+    SECTION( "seeking with keyframes" ) {
+        pp::EventLogReader reader(*out);
+        for(auto i : { 30, 3, 17, 0, 31, 8 }) {
+            reader.seek(recorder.times[i]);
+            REQUIRE(reader.events() == recorder.events[i]);
+            REQUIRE(logged_state(reader) == recorder.states[i]);
+        }
+    }
+}
+
+TEST_CASE( "gzip streams", "[writers][gzip]" ) {
+    std::string fname = "gzip_stream_test.txt.gz";
+    REQUIRE(pp::has_gzip_extension(fname));
+    REQUIRE(!pp::has_gzip_extension("gzip_stream_test.txt"));
+
+    /* more than one buffer of data, with a flush in the middle */
+    std::stringstream expected;
+    {
+        auto out = pp::open_output_stream(fname);
+        for(auto i = 0; i<100000; i++) {
+            *out << i << "\t" << i*0.5 << '\n';
+            expected << i << "\t" << i*0.5 << '\n';
+            if (i == 5000) out->flush();
+        }
+    }
+
+    auto in = pp::open_input_stream(fname);
+    std::stringstream found;
+    found << in->rdbuf();
+    REQUIRE(found.str() == expected.str());
+
+    /* compressed density output is the same as the plain output */
+    pp::Model m;
+    m += pp::Jump<pp::Tophat>(1, 1.0, 1.0);
+    m += pp::Birth<pp::Tophat>(1, 2, 0.1, 1.0);
+    m.done();
+    auto plain = std::make_shared<std::stringstream>();
+    {
+        pp::Simulator sim(10, m);
+        int seed = 3;
+        sim.set_seed(seed);
+        sim.fill(1, 0.5);
+        sim.make_writer<pp::DensityWriter>(plain, 0.1);
+        sim.make_writer<pp::DensityWriter>(pp::open_output_stream(fname), 0.1);
+        sim.run(5);
+    }
+    std::stringstream density;
+    density << pp::open_input_stream(fname)->rdbuf();
+    REQUIRE(density.str() == plain->str());
+    std::remove(fname.c_str());
+}
+
+/* Records the count of an entity after every event */
+struct CountRecorder : public pp::Writer, public pp::EventListener {
+    CountRecorder(pp::uint_t e) : pp::Writer(0), entity(e) {}
+
+    void event(const pp::SimulationState &s, pp::uint_t rid, const pp::point_del_buf_t &removed, const pp::point_add_buf_t &added) {
+        for(auto p : removed) count -= p->get_entity() == entity;
+        for(auto p : added) count += p->get_entity() == entity;
+        times.push_back(s.stats.time);
+        counts.push_back(count);
+    }
+    void write(pp::SimulationState &s, double t) {}
+    void start(pp::SimulationState &s) { count = s.get_count(entity); }
+    void end(pp::SimulationState &s) {}
+
+    pp::uint_t entity;
+    pp::uint_t count = 0;
+    std::vector<double> times;
+    std::vector<pp::uint_t> counts;
+};
+
+TEST_CASE( "summary writer records first passage times", "[writers][summary]" ) {
+    pp::Model m;
+    m += pp::DensityIndependentDeath(1, 0.5);
+    m += pp::Birth<pp::Tophat>(1, 1, 0.2, 1.0);
+    m += pp::Jump<pp::Tophat>(2, 1.0, 1.0);
+    m.done();
+
+    pp::Simulator sim(10, m);
+    int seed = 5;
+    sim.set_seed(seed);
+    sim.fill(1, 0.4);
+    sim.fill(2, 0.1);
+    auto out = std::make_shared<std::stringstream>();
+    auto &summary = sim.make_writer<pp::SummaryWriter>(out, std::vector<std::pair<pp::uint_t, std::string>>{ {1, "prey"}, {2, "walker"} });
+    summary.add_field("case.id", "7");
+    summary.add_field("name", pp::json_string("a \"b\""));
+    auto &recorder = sim.make_writer<CountRecorder>(1);
+    sim.run(4);
+
+    auto &prey = summary.get_watched()[0];
+    REQUIRE(prey.initial == 40);
+    REQUIRE(prey.final_count == sim.get_state().get_count(1));
+
+    /* first event after which the count is at or below each fraction */
+    auto fractions = pp::SummaryWriter::default_fractions();
+    REQUIRE(fractions.size() == prey.times.size());
+    for(auto i = 0u; i<fractions.size(); i++) {
+        double threshold = std::stod(fractions[i]) * prey.initial;
+        double expected = std::numeric_limits<double>::quiet_NaN();
+        if (prey.initial <= threshold) {
+            expected = 0;
+        } else {
+            for(auto j = 0u; j<recorder.counts.size(); j++) {
+                if (recorder.counts[j] <= threshold) {
+                    expected = recorder.times[j];
+                    break;
+                }
+            }
+        }
+        INFO("fraction " << fractions[i]);
+        REQUIRE(std::isnan(prey.times[i]) == std::isnan(expected));
+        if (!std::isnan(expected)) REQUIRE(prey.times[i] == expected);
+    }
+    REQUIRE(!std::isnan(prey.times[6])); // the prey halves during the run
+
+    /* the walkers never change in number */
+    auto &walker = summary.get_watched()[1];
+    REQUIRE(walker.initial == 10);
+    REQUIRE(walker.times[0] == 0);
+    REQUIRE(std::isnan(walker.times[1]));
+
+    auto line = out->str();
+    REQUIRE(line.find("{\"case.id\": 7, \"name\": \"a \\\"b\\\"\", \"time\": ") == 0);
+    REQUIRE(line.find("\"init.prey\": 40, \"final.prey\": ") != std::string::npos);
+    REQUIRE(line.find("\"time.walker.at.0.9\": null") != std::string::npos);
+    REQUIRE(line.back() == '\n');
+}
+
+TEST_CASE( "results files", "[writers][results]" ) {
+    std::string fname = "results_file_test.ppr";
+    std::remove(fname.c_str());
+    auto payload = [](unsigned t, unsigned i) {
+        std::stringstream p;
+        for(auto j = 0u; j<(i % 7)*50; j++) p << t << "\t" << i << "\t" << j << '\n';
+        return p.str();
+    };
+
+    /* concurrent appends through chunk streams and directly */
+    {
+        auto results = std::make_shared<pp::ResultsFile>(fname);
+        std::vector<std::thread> threads;
+        for(auto t = 0u; t<4; t++) {
+            threads.push_back(std::thread([=]() {
+                for(auto i = 0u; i<50; i++) {
+                    if (i % 2) {
+                        pp::ResultsChunkStream out(results, pp::RESULTS_DENSITY, t, i);
+                        out << payload(t, i);
+                    } else {
+                        results->append(pp::RESULTS_SUMMARY, t, i, payload(t, i));
+                    }
+                }
+            }));
+        }
+        for(auto &t : threads) t.join();
+        pp::ResultsFile uncompressed(fname, false);
+        uncompressed.append(pp::RESULTS_SUMMARY, 9, 9, "plain");
+    }
+
+    pp::ResultsReader reader(fname);
+    REQUIRE(!reader.is_truncated());
+    REQUIRE(reader.chunks().size() == 201);
+    std::set<std::pair<unsigned, unsigned>> seen;
+    for(auto &c : reader.chunks()) {
+        auto &h = c.header;
+        if (h.case_id == 9) {
+            REQUIRE(reader.read(c) == "plain");
+            REQUIRE(!(h.flags & pp::RESULTS_COMPRESSED));
+            continue;
+        }
+        REQUIRE(h.kind == (h.replicate % 2 ? pp::RESULTS_DENSITY : pp::RESULTS_SUMMARY));
+        REQUIRE(reader.read(c) == payload(h.case_id, h.replicate));
+        seen.insert(std::make_pair(h.case_id, h.replicate));
+    }
+    REQUIRE(seen.size() == 200);
+
+    /* a chunk cut short by a crash is skipped */
+    auto size = reader.chunks().back().offset + reader.chunks().back().header.size;
+    REQUIRE(truncate(fname.c_str(), size - 2) == 0);
+    pp::ResultsReader truncated(fname);
+    REQUIRE(truncated.is_truncated());
+    REQUIRE(truncated.chunks().size() == 200);
+
+    /* later runs append after the partial chunk; cut the payload of one, then a header */
+    auto append_after_cut = [&](uint64_t cut, uint32_t case_id) {
+        REQUIRE(truncate(fname.c_str(), cut) == 0);
+        pp::ResultsFile results(fname);
+        for(auto i = 0u; i<3; i++) {
+            results.append(pp::RESULTS_SUMMARY, case_id, i, payload(case_id, i + 1));
+        }
+    };
+    auto middle = reader.chunks()[100];
+    append_after_cut(middle.offset + middle.header.size/2, 10);
+    pp::ResultsReader resumed(fname);
+    REQUIRE(resumed.is_truncated());
+    REQUIRE(resumed.chunks().size() == 103);
+    append_after_cut(resumed.chunks().back().offset - 20, 11);
+    pp::ResultsReader twice(fname);
+    REQUIRE(twice.is_truncated());
+    REQUIRE(twice.chunks().size() == 105);
+    for(auto i = 0u; i<105; i++) {
+        auto &h = twice.chunks()[i].header;
+        if (i < 100) {
+            REQUIRE(h.case_id == reader.chunks()[i].header.case_id);
+            REQUIRE(h.replicate == reader.chunks()[i].header.replicate);
+        } else {
+            REQUIRE(h.case_id == (i < 102 ? 10u : 11u));
+            REQUIRE(h.replicate == (i < 102 ? i - 100 : i - 102));
+            REQUIRE(twice.read(twice.chunks()[i]) == payload(h.case_id, h.replicate + 1));
+        }
+    }
+    std::remove(fname.c_str());
+
+    /* an existing empty file is not a results file */
+    std::ofstream(fname.c_str());
+    REQUIRE_THROWS(pp::ResultsFile(fname));
+    std::remove(fname.c_str());
+}
+
+TEST_CASE( "confidence intervals of proportions", "[statistics]" ) {
+    REQUIRE(pp::normal_quantile(0.95) == Approx(1.959964).epsilon(1e-6));
+    REQUIRE(pp::normal_quantile(0.99) == Approx(2.575829).epsilon(1e-6));
+    REQUIRE_THROWS(pp::normal_quantile(1.0));
+
+    auto z = pp::normal_quantile(0.95);
+    auto none = pp::wilson_interval(0, 10, z);
+    REQUIRE(none.first < 1e-12);
+    REQUIRE(none.second == Approx(0.277533).epsilon(1e-5));
+    auto all = pp::wilson_interval(10, 10, z);
+    REQUIRE(all.first == Approx(1 - none.second));
+    REQUIRE(all.second > 1 - 1e-12);
+    auto half = pp::wilson_interval(50, 100, z);
+    REQUIRE(half.first == Approx(1 - half.second));
+    REQUIRE(half.second - half.first == Approx(0.190).epsilon(1e-2));
+
+    /* more trials give narrower intervals */
+    double width = 1;
+    for(unsigned long n = 10; n<=1000; n *= 10) {
+        auto ci = pp::wilson_interval(n/3, n, z);
+        REQUIRE(ci.second - ci.first < width);
+        width = ci.second - ci.first;
+    }
+}
+
+TEST_CASE( "logistic regression", "[statistics]" ) {
+    /* infection probability 1/(1+exp(-(1 + 2x))): 50% at x = -0.5 */
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> u(0, 1);
+    std::vector<double> x, y, w;
+    for(auto i = 0; i<=20; i++) {
+        double xi = -3 + 0.3*i;
+        double p = 1/(1 + std::exp(-(1 + 2*xi)));
+        int k = 0;
+        for(auto j = 0; j<200; j++) k += u(rng) < p;
+        x.push_back(xi);
+        y.push_back(k/200.0);
+        w.push_back(200);
+    }
+    auto f = pp::fit_logistic(x, y, w);
+    REQUIRE(f.converged);
+    REQUIRE(f.a == Approx(1).epsilon(0.15));
+    REQUIRE(f.b == Approx(2).epsilon(0.15));
+    REQUIRE(std::fabs(f.median() + 0.5) < 3*f.median_se());
+    REQUIRE(f.median_se() < 0.05);
+
+    /* outcomes separated at x = 0: the slope prior keeps the estimate finite */
+    std::vector<double> sx = { -2, -1, -0.5, 0.5, 1, 2 }, sy = { 0, 0, 0, 1, 1, 1 }, sw(6, 10);
+    auto g = pp::fit_logistic(sx, sy, sw, 20);
+    REQUIRE(g.converged);
+    REQUIRE(g.b > 0);
+    REQUIRE(std::fabs(g.median()) < 0.05);
+}
+
+TEST_CASE( "sweep cases are numbered as generate-cases numbers them", "[cases]" ) {
+    /* keys out of alphabetical order, and an alternative that overrides a combined key */
+    auto spec = nlohmann::json::parse(R"({"combine": {"b": [1, 2], "a": [0.1, 0.2, 0.3], "c": ["x"]},
+                                          "alternate": [{"d": 1}, {"d": 2, "a": 5}]})");
+    /* the order of generate-cases, which check-cases-order checks on the Python side */
+    auto expected = nlohmann::json::parse(R"([
+        {"a": 0.1, "b": 1, "c": "x", "d": 1}, {"a": 5, "b": 1, "c": "x", "d": 2},
+        {"a": 0.1, "b": 2, "c": "x", "d": 1}, {"a": 5, "b": 2, "c": "x", "d": 2},
+        {"a": 0.2, "b": 1, "c": "x", "d": 1}, {"a": 5, "b": 1, "c": "x", "d": 2},
+        {"a": 0.2, "b": 2, "c": "x", "d": 1}, {"a": 5, "b": 2, "c": "x", "d": 2},
+        {"a": 0.3, "b": 1, "c": "x", "d": 1}, {"a": 5, "b": 1, "c": "x", "d": 2},
+        {"a": 0.3, "b": 2, "c": "x", "d": 1}, {"a": 5, "b": 2, "c": "x", "d": 2}])");
+    auto cases = expand_cases(spec);
+    REQUIRE(cases.size() == expected.size());
+    for(auto i = 0u; i < cases.size(); i++) {
+        INFO("case " << i);
+        REQUIRE(cases[i] == expected[i]);
+    }
+
+    /* without alternatives */
+    spec.erase("alternate");
+    REQUIRE(expand_cases(spec).size() == 6);
+    REQUIRE(expand_cases(spec)[1] == nlohmann::json::parse(R"({"a": 0.1, "b": 2, "c": "x"})"));
+}
+
 TEST_CASE( "configurations", "[configurations]" ) {
     double U = 10;
     double bw = 1; 
@@ -0,0 +1,166 @@
+#ifndef __THREAD_POOL_H_
+#define __THREAD_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <algorithm>
+
+namespace pp {
+
+/*
+ * Fixed set of worker threads running queued tasks, e.g. the (case, replicate) simulations of
+ * a parameter sweep, whose run times differ by orders of magnitude.
+ *
+ * Tasks carry a predicted cost. Each worker has its own queue, ordered from the most to the
+ * least expensive task, and a task is queued to the worker with the least predicted work.
+ * Workers run their most expensive tasks first and, when their queue runs dry, steal the most
+ * expensive task of the worker with the most remaining work. The long runs thus start early
+ * and the short ones fill the gaps at the end, whatever the predictions got wrong, so the
+ * finishing time approaches the total work divided by the number of workers. Tasks are
+ * coarse (whole simulations), so one lock guards all the queues.
+ *
+ * If a task throws, the remaining queued tasks are dropped and wait() rethrows the first
+ * exception.
+ */
+class ThreadPool {
+public:
+    using task_t = std::function<void()>;
+
+    /* threads = 0 uses one thread per hardware thread */
+    explicit ThreadPool(unsigned int threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        queues.resize(threads);
+        for(auto i = 0u; i<threads; i++) {
+            workers.push_back(std::thread(&ThreadPool::run, this, i));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for(auto &w : workers) w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const { return workers.size(); }
+
+    /* Queue a task with its predicted cost (in any unit, only the ordering matters) */
+    void submit(task_t task, double cost = 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &q = *std::min_element(queues.begin(), queues.end(), [](const Queue &a, const Queue &b) {
+                return a.work < b.work || (a.work == b.work && a.tasks.size() < b.tasks.size());
+            });
+            auto pos = std::upper_bound(q.tasks.begin(), q.tasks.end(), cost, [](double c, const Task &t) {
+                return c > t.cost;
+            });
+            q.tasks.insert(pos, Task { std::move(task), cost });
+            q.work += cost;
+            queued++;
+        }
+        changed.notify_all();
+    }
+
+    /* Wait until all submitted tasks have finished */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return queued == 0 && running == 0; });
+        if (error) {
+            auto e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    /* Number of tasks that were taken from another worker's queue */
+    unsigned long get_steals() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return steals;
+    }
+
+private:
+    struct Task {
+        task_t run;
+        double cost;
+    };
+
+    struct Queue {
+        std::deque<Task> tasks; // most expensive first
+        double work = 0; // predicted cost of the queued tasks
+    };
+
+    /* Next task of worker i: its own most expensive one, or else that of the busiest worker */
+    Task take(unsigned int i) {
+        Task t;
+        if (!queues[i].tasks.empty()) {
+            t = std::move(queues[i].tasks.front());
+            queues[i].tasks.pop_front();
+            queues[i].work -= t.cost;
+        } else {
+            Queue *victim = nullptr;
+            for(auto &q : queues) {
+                if (!q.tasks.empty() && (!victim || q.work > victim->work)) victim = &q;
+            }
+            t = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+            victim->work -= t.cost;
+            steals++;
+        }
+        queued--;
+        return t;
+    }
+
+    void run(unsigned int i) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this]() { return queued > 0 || stopping; });
+            if (queued == 0) return; // stopping
+            auto task = take(i);
+            running++;
+            lock.unlock();
+
+            std::exception_ptr e;
+            try {
+                task.run();
+            } catch (...) {
+                e = std::current_exception();
+            }
+
+            lock.lock();
+            running--;
+            if (e && !error) {
+                error = e;
+                for(auto &q : queues) {
+                    q.tasks.clear();
+                    q.work = 0;
+                }
+                queued = 0;
+            }
+            changed.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    mutable std::mutex mutex;
+    std::condition_variable changed; // signalled when tasks are queued or finish
+    std::vector<Queue> queues; // tasks not yet started, one queue per worker
+    unsigned long queued = 0; // tasks in all queues
+    unsigned int running = 0; // tasks being run
+    unsigned long steals = 0;
+    bool stopping = false;
+    std::exception_ptr error; // first exception thrown by a task
+};
+
+} // namespace
+
+#endif
@@ -8,6 +8,7 @@
 #include "pointset.h"
 
 #include <vector>
+#include <memory>
 #include <initializer_list>
 #include <unordered_set>
 #include <unordered_map>
@@ -24,11 +25,19 @@ namespace pp {
 class Tracker {
 public:
     Tracker() : simulation_state(nullptr) {}
+    virtual ~Tracker() {}
     virtual void activate(point_del_buf_t &removed, point_add_buf_t &added) = 0; 
     virtual double propensity() const = 0; 
     virtual void notify_removal(Point &p) = 0;
     virtual void notify_add(Point &p) = 0;
     virtual const IProcess &get_process() const = 0;
+    /* New tracker of the same process, not initialised and without any tracked state */
+    virtual std::unique_ptr<Tracker> fresh_copy() const = 0;
+    /* Copy the tracked state of a tracker of the same process whose state was copied into ours */
+    virtual void copy_state_from(const Tracker &other) = 0;
+    /* Tracked state for checkpoints; restored after the points of the simulation state */
+    virtual void write_checkpoint(CheckpointWriter &w) const = 0;
+    virtual void read_checkpoint(CheckpointReader &r) = 0;
 
     /* Before simulation starts, initialise the tracker with this */
     void initialise(SimulationState *s) { 
@@ -44,7 +53,7 @@ template<typename P, int INPUTS>
 class ImplTracker;
 
 template<typename P>
-class ImplTracker<P, 0> : public Tracker {
+class ImplTracker<P, 0> final : public Tracker {
 public:
     static_assert(P::input_count == 0, "ImplTracker<P,0> called with a process that does not have 0 inputs");
     ImplTracker<P,0>(P p) : process(p) { }
@@ -54,6 +63,11 @@ public:
     }
 
     const IProcess &get_process() const { return process; }
+    const P &get_typed_process() const { return process; }
+    std::unique_ptr<Tracker> fresh_copy() const { return std::unique_ptr<Tracker>(new ImplTracker<P,0>(process)); }
+    void copy_state_from(const Tracker &other) { } // nothing tracked
+    void write_checkpoint(CheckpointWriter &w) const { }
+    void read_checkpoint(CheckpointReader &r) { }
 
     double propensity() const { return process.propensity(*simulation_state); }
     void notify_removal(Point &p) { }
@@ -63,7 +77,7 @@ protected:
 };
 
 template<typename P>
-class ImplTracker<P, 1> : public Tracker {
+class ImplTracker<P, 1> final : public Tracker {
 public:
     static_assert(P::input_count == 1, "Trying to generate ImplTracker<P,1> with a process that does not have 1 input");
     ImplTracker<P,1>(P p) : process(p) {}
@@ -74,6 +88,11 @@ public:
     }
 
     const IProcess &get_process() const { return process; }
+    const P &get_typed_process() const { return process; }
+    std::unique_ptr<Tracker> fresh_copy() const { return std::unique_ptr<Tracker>(new ImplTracker<P,1>(process)); }
+    void copy_state_from(const Tracker &other) { } // nothing tracked
+    void write_checkpoint(CheckpointWriter &w) const { }
+    void read_checkpoint(CheckpointReader &r) { }
 
     /* for single point processes the propensity is given by the number of points */
     inline double propensity() const { 
@@ -89,7 +108,7 @@ protected:
 
 
 template<typename P>
-class ImplTracker<P, 2> : public Tracker {
+class ImplTracker<P, 2> final : public Tracker {
 public:
     static_assert(P::input_count == 2, "Trying to generate ImplTracker<P,2> with a process that does not have two inputs");
 
@@ -104,6 +123,26 @@ public:
     }
 
     const IProcess &get_process() const { return process; }
+    const P &get_typed_process() const { return process; }
+    std::unique_ptr<Tracker> fresh_copy() const { return std::unique_ptr<Tracker>(new ImplTracker<P,2>(process)); }
+
+    /* The configurations of other with its points replaced by their copies in our state */
+    void copy_state_from(const Tracker &other) {
+        auto &o = dynamic_cast<const ImplTracker<P,2>&>(other);
+        auto state = simulation_state;
+        configurations.copy_from(o.configurations, [state](const Point *p) { return state->corresponding(p); });
+    }
+
+    /* The configurations in their bucket order, which decides the sampled configurations */
+    void write_checkpoint(CheckpointWriter &w) const {
+        auto state = simulation_state;
+        configurations.write_checkpoint(w, [&w, state](const Point *p) { state->write_ref(w, p); });
+    }
+
+    void read_checkpoint(CheckpointReader &r) {
+        auto state = simulation_state;
+        configurations.read_checkpoint(r, [&r, state]() { return state->read_ref(r); });
+    }
 
     inline double propensity() const { 
         /* NOTE: We assume Tophat kernel everywhere, that is, each configuration has the same propensity */
@@ -2,72 +2,111 @@
 #define __WRITER_H_
 
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <algorithm>
 #include "common.h"
 #include "point.h"
 #include "simulation_state.h"
+#include "checkpoint.h"
 
 namespace pp {
 
 /*
  * Writer interface.
+ *
+ * The simulator calls write(s, t) at the grid times t = k*delta (k = 1, 2, ...) that fall within 
+ * a run, with s being the state at time t, i.e. before the first event after t. 
+ * A writer with delta <= 0 only writes at start and end.
  */
 struct Writer {
-    virtual void process_activated(SimulationState &s, double tau, uint_t process_id) = 0;
+    Writer(double d) : delta(d) {}
+    virtual ~Writer() {}
+    virtual void write(SimulationState &s, double t) = 0;
     virtual void start(SimulationState &s) = 0;
     virtual void end(SimulationState &s) = 0;
+
+    /* State kept between start and end, for checkpoints of a run in progress */
+    virtual void write_checkpoint(CheckpointWriter &w) const {}
+    virtual void read_checkpoint(CheckpointReader &r) {}
+
+    /* Flush buffered output, e.g. before a checkpoint records the output sizes */
+    virtual void flush() {}
+
+    const double delta; // time between writes
+};
+
+/*
+ * Writers that also derive from EventListener are told about every event: event() is called
+ * after the process has chosen the removed and added points but before the removed points are
+ * destroyed, with s.stats already at the time of the event.
+ */
+struct EventListener {
+    virtual ~EventListener() {}
+    virtual void event(const SimulationState &s, uint_t rid, const point_del_buf_t &removed, const point_add_buf_t &added) = 0;
 };
 
+/* 
+ * Write "entity x y " for each point, with coordinates formatted like join(" ", ...) but
+ * without a temporary string stream per point. get(item) gives the point of each item.
+ */
+template<typename C, typename F>
+void write_points(std::ostream &out, const C &items, F get) {
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(10);
+    for(const auto &item : items) {
+        const auto &p = get(item);
+        out << p->get_entity() << " " << (*p)[0] << " " << (*p)[1] << " ";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
 struct SnapshotWriter : public Writer {
 
-    SnapshotWriter(std::shared_ptr<std::ostream> o, double d) : out(o), delta(d), current(0) {}
+    SnapshotWriter(std::shared_ptr<std::ostream> o, double d) : Writer(d), out(o) {}
 
-    void process_activated(SimulationState &s, double tau, uint_t process_id) {
-        current += tau;
-        if (current >= delta) {
-            write_state(s);
-            current = 0;
-        }
+    void write(SimulationState &s, double t) {
+        write_state(s, t);
     }
 
-    void write_state(SimulationState &s) {
-        *out << s.stats.time << " " << s.stats.total_events << " ";
-        for(auto p : s.enumerate()) {
-            *out << p->get_entity() << " " << join(" ", p->get_coord().get_values()) << " ";
-        }
-        *out << std::endl;
-
+    void write_state(SimulationState &s, double t) {
+        *out << t << " " << s.stats.total_events << " ";
+        write_points(*out, s.enumerate(), [](const Point *p) { return p; });
+        *out << '\n';
     }
 
     void start(SimulationState &s) {
-        write_state(s);
+        write_state(s, s.stats.time);
     }
 
     void end(SimulationState &s) {
-        write_state(s);
+        write_state(s, s.stats.time);
     }
 
+    void flush() { out->flush(); }
+
     std::shared_ptr<std::ostream> out;
-    double delta;
-    double current;
 };
 
 struct DensityWriter : public Writer {
-    DensityWriter(std::shared_ptr<std::ostream> o, double d) : out(o), delta(d), current(0) {}
+    DensityWriter(std::shared_ptr<std::ostream> o, double d) : Writer(d), out(o) {}
     
-    void process_activated(SimulationState &s, double tau, uint_t process_id) {
-        current += tau;
-        if (current >= delta) {
-            write_state(s);
-            current=0;
-        }
+    void write(SimulationState &s, double t) {
+        write_state(s, t);
     }
 
-    void write_state(SimulationState &s) {
-        *out << s.stats.time << "\t" << s.stats.total_events;
+    void write_state(SimulationState &s, double t) {
+        *out << t << "\t" << s.stats.total_events;
         for(auto i = 0; i<=s.get_max_entities(); i++) {
             *out << "\t" << s.get_count(i);
         }
-        *out << std::endl;
+        *out << '\n';
     }
 
     void start(SimulationState &s) {
@@ -76,17 +115,163 @@ struct DensityWriter : public Writer {
         for(auto i = 0; i<=s.get_max_entities(); i++) {
             *out << "\t" << i;
         }
-        *out << std::endl;
-        write_state(s);
+        *out << '\n';
+        write_state(s, s.stats.time);
     }
 
     void end(SimulationState &s) {
-        write_state(s);
+        write_state(s, s.stats.time);
+    }
+
+    void flush() { out->flush(); }
+
+    std::shared_ptr<std::ostream> out;
+};
+
+/* Quote a string for JSON output */
+inline std::string json_string(const std::string &s) {
+    std::string r = "\"";
+    for(auto c : s) {
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if (c == '\n') {
+            r += "\\n";
+        } else {
+            r += c;
+        }
+    }
+    return r + "\"";
+}
+
+/*
+ * Summary of the infection outcome of a run, kept online instead of from the density series.
+ *
+ * For each watched entity, records its initial and final count and the first time at which the
+ * count falls to each fraction of the initial count (count <= fraction * initial). Because counts
+ * are checked after every event, the times are exact event times rather than the first density
+ * row at or below the fraction. end() writes one JSON object per line with the fields added with
+ * add_field (e.g. case parameters and seed) and, for each entity name,
+ * "init.name", "final.name" and "time.name.at.fraction" (null if never reached).
+ */
+class SummaryWriter : public Writer, public EventListener {
+public:
+    struct Watched {
+        uint_t entity;
+        std::string name;
+        uint_t initial = 0;
+        uint_t final_count = 0;
+        std::vector<double> times; // first passage time for each fraction, NaN if not reached
+        uint_t reached = 0; // fractions are sorted in decreasing order; the first 'reached' are done
+    };
+
+    /* Fractions as written in the column names, e.g. "0.25" */
+    static std::vector<std::string> default_fractions() {
+        return { "1.0", "0.9", "0.8", "0.75", "0.7", "0.6", "0.5", "0.4", "0.3", "0.25", "0.2", "0.1", "0.0" };
+    }
+
+    SummaryWriter(std::shared_ptr<std::ostream> o, const std::vector<std::pair<uint_t, std::string>> &entities,
+                  const std::vector<std::string> &fraction_names = default_fractions()) : Writer(0), out(o) {
+        for(auto &f : fraction_names) {
+            fractions.push_back(std::make_pair(std::stod(f), f));
+        }
+        std::sort(fractions.begin(), fractions.end(), [](const std::pair<double,std::string> &a, const std::pair<double,std::string> &b) { return a.first > b.first; });
+        for(auto &e : entities) {
+            Watched w;
+            w.entity = e.first;
+            w.name = e.second;
+            watched.push_back(w);
+        }
+    }
+
+    /* Extra field; value must already be JSON (e.g. a number or json_string(...)) */
+    void add_field(const std::string &name, const std::string &json_value) {
+        fields.push_back(std::make_pair(name, json_value));
+    }
+
+    void start(SimulationState &s) {
+        for(auto &w : watched) {
+            w.initial = s.get_count(w.entity);
+            w.times.assign(fractions.size(), std::numeric_limits<double>::quiet_NaN());
+            w.reached = 0;
+            update(w, w.initial, s.stats.time);
+        }
+    }
+
+    void write(SimulationState &s, double t) {}
+
+    void event(const SimulationState &s, uint_t rid, const point_del_buf_t &removed, const point_add_buf_t &added) {
+        for(auto &w : watched) {
+            /* s has the counts before the event */
+            int64_t count = s.get_count(w.entity);
+            for(auto p : removed) count -= p->get_entity() == w.entity;
+            for(auto p : added) count += p->get_entity() == w.entity;
+            update(w, count, s.stats.time);
+        }
+    }
+
+    void end(SimulationState &s) {
+        auto precision = out->precision();
+        *out << std::setprecision(12) << "{";
+        for(auto &f : fields) {
+            *out << json_string(f.first) << ": " << f.second << ", ";
+        }
+        *out << "\"time\": " << s.stats.time << ", \"events\": " << s.stats.total_events;
+        for(auto &w : watched) {
+            w.final_count = s.get_count(w.entity);
+            *out << ", " << json_string("init." + w.name) << ": " << w.initial;
+            *out << ", " << json_string("final." + w.name) << ": " << w.final_count;
+            for(auto i = 0u; i<fractions.size(); i++) {
+                *out << ", " << json_string("time." + w.name + ".at." + fractions[i].second) << ": ";
+                if (std::isnan(w.times[i])) {
+                    *out << "null";
+                } else {
+                    *out << w.times[i];
+                }
+            }
+        }
+        *out << "}\n";
+        out->precision(precision);
+        out->flush();
+    }
+
+    /* Initial counts and first passage times so far */
+    void write_checkpoint(CheckpointWriter &w) const {
+        w.value<uint64_t>(watched.size());
+        for(auto &x : watched) {
+            w.value(x.initial);
+            w.vector(x.times);
+            w.value(x.reached);
+        }
+    }
+
+    void read_checkpoint(CheckpointReader &r) {
+        r.expect<uint64_t>(watched.size(), "summary entities");
+        for(auto &x : watched) {
+            x.initial = r.value<uint_t>();
+            x.times = r.vector<double>();
+            x.reached = r.value<uint_t>();
+            if (x.times.size() != fractions.size() || x.reached > fractions.size()) {
+                throw std::runtime_error("Checkpoint does not match the simulation: different summary fractions");
+            }
+        }
+    }
+
+    void flush() { out->flush(); }
+
+    const std::vector<Watched> &get_watched() const { return watched; }
+
+private:
+    inline void update(Watched &w, int64_t count, double t) {
+        while (w.reached < fractions.size() && count <= fractions[w.reached].first * w.initial) {
+            w.times[w.reached++] = t;
+        }
     }
 
     std::shared_ptr<std::ostream> out;
-    double delta;
-    double current;
+    std::vector<std::pair<double, std::string>> fractions; // value and name, decreasing
+    std::vector<Watched> watched;
+    std::vector<std::pair<std::string, std::string>> fields;
 };
 
 } // namespace
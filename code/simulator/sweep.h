@@ -0,0 +1,673 @@
+/*
+ * Parameter sweeps in a single process (toxin --cases cases.json --replicates R).
+ *
+ * The cases file has the format used by generate-cases: every combination of the "combine"
+ * lists, each with every "alternate" set of parameters on top. Cases are numbered from 1 in
+ * the order generate-cases uses: the keys of "combine" in alphabetical order with the last one
+ * varying fastest (see cases.h). The model of each case is built once and every replicate runs
+ * a clone of it on the thread pool, with the RNG stream (case, replicate) of the master seed.
+ * The replicates are ordered by their predicted run time (see RuntimeHistory), longest first,
+ * on a work-stealing thread pool.
+ *
+ * With a confidence interval width (--ci-width) the replicates of each case run in batches,
+ * and a case stops once the Wilson interval of its infection probability is narrow enough;
+ * cases whose outcome is clear stop after a few batches, cases near the dose-response
+ * threshold use up to the maximum number of replicates. A replicate counts as infected if
+ * the outcome entity (bacteria) survives it: runs halt when the bacteria or the tissue die out.
+ *
+ * With --shared-setup (or an --input point file) the initial state of a case is set up once
+ * and copied into each replicate, which only reseeds its generator (see shared_setup).
+ *
+ * With splitting levels (--split-levels) each case instead gets repeated multilevel splitting
+ * estimates of its infection probability (see run_splitting), for doses at which infection is
+ * too rare to count in plain replicates.
+ *
+ * Included from main.cpp after the model, whose get_model and setup_state it uses, and after
+ * the SIGINT flag and log_interrupt.
+ */
+#ifndef __SWEEP_H_
+#define __SWEEP_H_
+
+#include <memory>
+#include <mutex>
+#include <map>
+#include <set>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cases.h"
+
+/*
+ * Output shared by the replicates. Each replicate writes into its own buffer, which is
+ * appended to the output as a whole when the replicate's stream is released.
+ */
+class SharedOutput {
+public:
+    SharedOutput(std::shared_ptr<std::ostream> o) : out(o) {}
+
+    std::shared_ptr<std::ostream> open() {
+        auto self = this;
+        return std::shared_ptr<std::ostream>(new std::ostringstream(), [self](std::ostream *s) {
+            self->append(static_cast<std::ostringstream*>(s)->str());
+            delete s;
+        });
+    }
+
+    void append(const std::string &data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        *out << data;
+        out->flush();
+    }
+
+private:
+    std::shared_ptr<std::ostream> out;
+    std::mutex mutex;
+};
+
+/*
+ * Run times of earlier sweeps (--runtimes FILE), one JSON line per replicate. A case is
+ * identified by its parameters, domain and simulation time.
+ */
+class RuntimeHistory {
+public:
+    RuntimeHistory() {}
+
+    explicit RuntimeHistory(const std::string &fname) {
+        std::ifstream in(fname);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty()) continue;
+            auto r = json::parse(line);
+            auto &t = times[r["key"].dump()];
+            t.first += r["seconds"].get<double>();
+            t.second++;
+        }
+        out = std::make_shared<SharedOutput>(std::make_shared<std::ofstream>(fname, std::ios::out | std::ios::app));
+    }
+
+    static std::string key(const json &input, double U, double time) {
+        return json({ { "case", input.count("case") ? input["case"] : json::object() }, { "domain", U }, { "time", time } }).dump();
+    }
+
+    bool has(const std::string &key) const { return times.count(key); }
+
+    /* Mean run time in seconds */
+    double mean(const std::string &key) const {
+        auto &t = times.at(key);
+        return t.first / t.second;
+    }
+
+    void record(const std::string &key, double seconds) {
+        if (!out) return;
+        out->append(json({ { "key", json::parse(key) }, { "seconds", seconds } }).dump() + "\n");
+    }
+
+private:
+    std::map<std::string, std::pair<double, unsigned int>> times; // total seconds and runs
+    std::shared_ptr<SharedOutput> out;
+};
+
+/* Initial number of points of a case: its Initial...Density parameters times the area */
+double initial_points(const json &input, double U) {
+    double density = 0;
+    auto &p = input["parameters"];
+    for(auto it = p.begin(); it != p.end(); ++it) {
+        auto k = it.key();
+        if (k.size() > 14 && k.compare(0, 7, "Initial") == 0 && k.compare(k.size() - 7, 7, "Density") == 0 && it.value().is_number()) {
+            density += it.value().get<double>();
+        }
+    }
+    return density * U * U;
+}
+
+/*
+ * Predicted cost of a replicate of each case. Cases with recorded run times use their mean.
+ * The prior of the others is the initial event rate times the simulated time: the total
+ * propensity of the shared initial state of the case if there is one, or else the initial
+ * number of points of the case, which grows with the dose and the domain. The priors are
+ * scaled to seconds by the ratio of the two over the recorded cases. Nothing is set up here,
+ * so the first replicates start at once.
+ */
+template<typename M>
+std::vector<double> predict_costs(const std::vector<std::shared_ptr<const json>> &inputs, const std::vector<std::shared_ptr<const BasicSimulator<M>>> &initial,
+                                  const RuntimeHistory &history, double U, double time) {
+    std::vector<double> prior, cost;
+    double measured_total = 0, prior_total = 0;
+    for(auto i = 0u; i<inputs.size(); i++) {
+        double rate = 0;
+        if (i < initial.size() && initial[i]) {
+            for(auto r = 0u; r<initial[i]->model.process_count(); r++) {
+                rate += initial[i]->model.propensity(r);
+            }
+        } else {
+            rate = initial_points(*inputs[i], U);
+        }
+        prior.push_back(rate * time);
+
+        auto key = RuntimeHistory::key(*inputs[i], U, time);
+        if (history.has(key)) {
+            measured_total += history.mean(key);
+            prior_total += prior.back();
+        }
+    }
+    double scale = prior_total > 0 ? measured_total / prior_total : 1;
+    for(auto i = 0u; i<inputs.size(); i++) {
+        auto key = RuntimeHistory::key(*inputs[i], U, time);
+        cost.push_back(history.has(key) ? history.mean(key) : prior[i] * scale);
+    }
+    return cost;
+}
+
+struct SweepSettings {
+    double time;
+    double U;
+    double dt;
+    seed_t master_seed;
+    std::string summary_entities;
+    std::shared_ptr<ResultsFile> results; // density series and summaries, if set
+    bool results_summary_only = false;
+    std::shared_ptr<SharedOutput> summary; // summary lines, if set
+    std::string runtimes; // runtime history file, if set
+    uint_t outcome_entity; // infected if this entity survives
+    double ci_width = 0; // sequential stopping if positive
+    double confidence = 0.95;
+    uint32_t batch = 10; // replicates per batch (or per dose in an ID50 search) with sequential stopping
+    bool shared_setup = false; // set up each case once and copy its initial state into the replicates
+    std::string input_points; // points read into the shared initial state, if set
+};
+
+/* Replicate number of the RNG stream that sets up the shared initial state of a case */
+static constexpr uint32_t SETUP_REPLICATE = 0xffffffff;
+
+/*
+ * Initial state of a case for all its replicates: the filled domain and the configurations
+ * tracked for it are built once, from the setup stream of the case, instead of once per
+ * replicate. The replicates thus share their initial configuration, as with an input file.
+ */
+template<typename M>
+std::shared_ptr<const BasicSimulator<M>> shared_setup(const json &input, const M &model, uint32_t case_id, const SweepSettings &settings) {
+    auto s = std::make_shared<BasicSimulator<M>>(settings.U, model.clone());
+    s->add_halting_flag(&SIG_INT_RECEIVED);
+    s->set_stream(settings.master_seed, StreamId(case_id, SETUP_REPLICATE));
+    setup_state(*s, input);
+    if (!settings.input_points.empty()) {
+        auto n = read_input_points(*s, std::ifstream(settings.input_points));
+        LOG("Case " << case_id << ": " << n << " input points read");
+    }
+    return s;
+}
+
+struct ReplicateResult {
+    bool completed = false; // false if interrupted
+    bool infected = false;
+};
+
+/* Run a replicate from the shared initial state of its case if given, or else set it up itself */
+template<typename M>
+ReplicateResult run_replicate(const json &input, const M &model, const BasicSimulator<M> *initial, uint32_t case_id, uint32_t replicate, 
+                              const SweepSettings &settings) {
+    ReplicateResult result;
+    if (SIG_INT_RECEIVED) {
+        log_interrupt();
+        return result;
+    }
+
+    BasicSimulator<M> s(settings.U, model.clone());
+    if (initial) {
+        s.copy_state_from(*initial);
+        s.set_stream(settings.master_seed, StreamId(case_id, replicate));
+    } else {
+        s.add_halting_flag(&SIG_INT_RECEIVED);
+        s.set_stream(settings.master_seed, StreamId(case_id, replicate));
+        setup_state(s, input);
+    }
+
+    auto add_ids = [&](SummaryWriter &w) {
+        w.add_field("seed", std::to_string(settings.master_seed));
+        w.add_field("case", std::to_string(case_id));
+        w.add_field("replicate", std::to_string(replicate));
+    };
+    if (settings.results) {
+        if (!settings.results_summary_only) {
+            s.template make_writer<DensityWriter>(std::make_shared<ResultsChunkStream>(settings.results, RESULTS_DENSITY, case_id, replicate), settings.dt);
+        }
+        add_ids(make_summary_writer(s, std::make_shared<ResultsChunkStream>(settings.results, RESULTS_SUMMARY, case_id, replicate), input, settings.summary_entities));
+    }
+    if (settings.summary) {
+        add_ids(make_summary_writer(s, settings.summary->open(), input, settings.summary_entities));
+    }
+
+    s.run(settings.time);
+    log_interrupt();
+    LOG("Case " << case_id << ", replicate " << replicate << " stopped at time " << s.get_state().stats.time
+        << ". Halting reason: " << s.get_halt_reason());
+    result.completed = !SIG_INT_RECEIVED;
+    result.infected = s.get_state().get_count(settings.outcome_entity) > 0;
+    return result;
+}
+
+/*
+ * Runs replicates on the thread pool and keeps the run time history and totals. The callback
+ * of a replicate is called on its worker thread under the runner's lock and may submit more
+ * replicates, e.g. the next batch of an adaptive design.
+ */
+class ReplicateRunner {
+public:
+    using callback_t = std::function<void(const ReplicateResult&)>;
+
+    ReplicateRunner(const SweepSettings &s, unsigned int threads) : settings(s), pool(threads) {
+        if (!settings.runtimes.empty()) {
+            history = RuntimeHistory(settings.runtimes);
+        }
+        LOG("Running on " << pool.size() << " threads");
+    }
+
+    /* initial is the shared initial state of the case, if any */
+    template<typename M>
+    void submit(std::shared_ptr<const json> input, std::shared_ptr<const M> model, std::shared_ptr<const BasicSimulator<M>> initial,
+                uint32_t case_id, uint32_t replicate, double cost, callback_t done) {
+        pool.submit([this, input, model, initial, case_id, replicate, done]() {
+            auto start = std::chrono::steady_clock::now();
+            auto result = run_replicate(*input, *model, initial.get(), case_id, replicate, settings);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (result.completed) {
+                history.record(RuntimeHistory::key(*input, settings.U, settings.time), seconds);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            total_seconds += seconds;
+            total_replicates += result.completed;
+            done(result);
+        }, cost);
+    }
+
+    /* Run another task on the pool, e.g. the setup of a batch of replicates; it runs without the lock */
+    void submit_task(std::function<void()> task, double cost) { pool.submit(task, cost); }
+
+    void wait() { pool.wait(); }
+
+    /* Submissions outside callbacks take this lock */
+    std::mutex &get_mutex() { return mutex; }
+
+    const RuntimeHistory &get_history() const { return history; }
+
+    void log_totals() const {
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LOG("Sweep finished in " << seconds << " s; " << total_replicates << " replicates, " << total_seconds << " s of simulation on " 
+            << pool.size() << " threads (" << total_seconds / pool.size() << " s per thread), " << pool.get_steals() << " tasks stolen");
+    }
+
+private:
+    const SweepSettings &settings;
+    RuntimeHistory history;
+    std::mutex mutex;
+    double total_seconds = 0;
+    uint32_t total_replicates = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ThreadPool pool; // last, so that the workers stop before the rest is destroyed
+};
+
+/* Indices of the cases, longest predicted run time first */
+std::vector<uint32_t> longest_first(const std::vector<double> &costs) {
+    std::vector<uint32_t> order(costs.size());
+    for(auto i = 0u; i<costs.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return costs[a] > costs[b]; });
+    return order;
+}
+
+/* Replicates of a case so far */
+struct CaseProgress {
+    uint32_t submitted = 0;
+    uint32_t finished = 0;
+    uint32_t infected = 0;
+};
+
+/* Run the replicates of all cases on a thread pool */
+void run_sweep(const json &model_input, const json &spec, uint32_t replicates, unsigned int threads, const SweepSettings &settings) {
+    auto cases = expand_cases(spec);
+    bool sequential = settings.ci_width > 0;
+    if (sequential) {
+        LOG("Sweep of " << cases.size() << " cases in batches of " << settings.batch << " replicates until the " 
+            << settings.confidence << " interval of the infection probability is narrower than " << settings.ci_width
+            << " (at most " << replicates << " replicates), master seed " << settings.master_seed);
+    } else {
+        LOG("Sweep of " << cases.size() << " cases with " << replicates << " replicates each, master seed " << settings.master_seed);
+    }
+    auto z = normal_quantile(settings.confidence);
+
+    using model_t = decltype(get_model(model_input));
+    std::vector<std::shared_ptr<const json>> inputs;
+    std::vector<std::shared_ptr<const model_t>> models;
+    for(auto i = 0u; i<cases.size(); i++) {
+        inputs.push_back(std::make_shared<json>(case_input(model_input, cases[i], i+1)));
+        auto m = std::make_shared<model_t>(get_model(*inputs.back()));
+        m->done();
+        models.push_back(m);
+    }
+
+    std::vector<std::shared_ptr<const BasicSimulator<model_t>>> initial(cases.size());
+    if (settings.shared_setup) {
+        for(auto i = 0u; i<cases.size(); i++) {
+            initial[i] = shared_setup(*inputs[i], *models[i], i+1, settings);
+        }
+    }
+
+    ReplicateRunner runner(settings, threads);
+    auto costs = predict_costs(inputs, initial, runner.get_history(), settings.U, settings.time);
+    std::vector<CaseProgress> progress(cases.size());
+
+    /* Queue the next batch of case i; called under the runner's lock */
+    std::function<void(uint32_t)> submit_batch = [&](uint32_t i) {
+        auto &p = progress[i];
+        auto n = std::min(sequential ? settings.batch : replicates, replicates - p.submitted);
+        for(auto r = p.submitted; r<p.submitted + n; r++) {
+            runner.submit(inputs[i], models[i], initial[i], i+1, r, costs[i], [&, i](const ReplicateResult &result) {
+                auto &c = progress[i];
+                c.finished++;
+                if (!result.completed) return;
+                c.infected += result.infected;
+                if (c.finished < c.submitted) return;
+
+                /* end of a batch */
+                auto ci = wilson_interval(c.infected, c.finished, z);
+                if (sequential && ci.second - ci.first > settings.ci_width && c.submitted < replicates) {
+                    submit_batch(i);
+                } else {
+                    LOG("Case " << i+1 << ": " << c.infected << " of " << c.finished << " replicates infected, " 
+                        << settings.confidence << " interval [" << ci.first << ", " << ci.second << "]");
+                }
+            });
+        }
+        p.submitted += n;
+    };
+    {
+        std::lock_guard<std::mutex> lock(runner.get_mutex());
+        for(auto i : longest_first(costs)) submit_batch(i);
+    }
+    runner.wait();
+    runner.log_totals();
+}
+
+/* Prior standard deviation of the logistic slope per log10 dose; 20 is a rise from 25% to 75% within 0.11 log10 units */
+static constexpr double ID50_SLOPE_SD = 20;
+
+struct Id50Settings {
+    std::string parameter; // dose parameter, e.g. InitialBacteriaDensity
+    double low, high; // dose range
+    double ci_width; // of the ID50 interval in log10 dose
+    uint32_t initial_doses = 5; // first design: log-spaced doses over the range
+    std::shared_ptr<SharedOutput> output; // one JSON line per combination, if set
+};
+
+/* Outcomes of the ID50 search of one combination of the other parameters */
+struct Id50Search {
+    explicit Id50Search(const json &p) : parameters(p) {}
+
+    json parameters;
+    std::vector<double> x, infected, n; // log10 dose, infected and completed replicates per design point
+    uint32_t submitted = 0;
+    uint32_t pending = 0; // replicates of the current round not yet finished
+    bool interrupted = false;
+};
+
+/*
+ * Adaptive estimation of the 50% infective dose (toxin --cases cases.json --id50 PARAMETER).
+ *
+ * For every combination of the other parameters of the cases file, a logistic regression of
+ * infection on log10 dose is fitted with a sequential design: the first round runs a batch of
+ * replicates at log-spaced doses over the range, each later round a batch at the current
+ * ID50 estimate and at the doses of 25% and 75% infection probability, where the replicates
+ * are most informative. The search stops when the confidence interval of the ID50 (delta
+ * method) is narrower than the given width in log10 dose, or after the maximum number of
+ * replicates. Half a pseudo-observation of no infection at the lowest dose and of infection
+ * at the highest keeps the fit finite while all outcomes agree, and a weak prior on the slope
+ * while the outcomes are separated by dose (a sharp threshold).
+ */
+void run_id50_search(const json &model_input, const json &spec, uint32_t replicates, unsigned int threads, 
+                     const SweepSettings &settings, const Id50Settings &id50) {
+    /* combinations of the other parameters */
+    std::vector<Id50Search> searches;
+    std::set<std::string> seen;
+    for(auto &c : expand_cases(spec)) {
+        auto p = c;
+        p.erase(id50.parameter);
+        if (seen.insert(p.dump()).second) {
+            searches.emplace_back(p);
+        }
+    }
+    double lo = std::log10(id50.low), hi = std::log10(id50.high);
+    auto z = normal_quantile(settings.confidence);
+    LOG("ID50 search over " << id50.parameter << " in [" << id50.low << ", " << id50.high << "] for " << searches.size() 
+        << " combinations until the " << settings.confidence << " interval is narrower than " << id50.ci_width 
+        << " in log10 dose (at most " << replicates << " replicates), master seed " << settings.master_seed);
+
+    using model_t = decltype(get_model(model_input));
+    auto make_input = [&](uint32_t i, double x) {
+        auto p = searches[i].parameters;
+        p[id50.parameter] = std::pow(10.0, x);
+        return std::make_shared<const json>(case_input(model_input, p, i+1));
+    };
+    auto make_model = [&](const json &input) {
+        auto m = std::make_shared<model_t>(get_model(input));
+        m->done();
+        return std::shared_ptr<const model_t>(m);
+    };
+
+    /* costs at the geometric midpoint of the range */
+    std::vector<std::shared_ptr<const json>> inputs;
+    for(auto i = 0u; i<searches.size(); i++) {
+        inputs.push_back(make_input(i, (lo + hi)/2));
+    }
+    ReplicateRunner runner(settings, threads);
+    auto costs = predict_costs(inputs, std::vector<std::shared_ptr<const BasicSimulator<model_t>>>(), runner.get_history(), settings.U, settings.time);
+
+    auto fit = [&](const Id50Search &s) {
+        std::vector<double> x = s.x, y, w = s.n;
+        for(auto j = 0u; j<s.x.size(); j++) {
+            y.push_back(s.n[j] > 0 ? s.infected[j]/s.n[j] : 0);
+        }
+        x.push_back(lo); y.push_back(0); w.push_back(0.5);
+        x.push_back(hi); y.push_back(1); w.push_back(0.5);
+        return fit_logistic(x, y, w, ID50_SLOPE_SD);
+    };
+
+    auto report = [&](uint32_t i, const LogisticFit &f) {
+        auto &s = searches[i];
+        double x50 = f.median(), half = z*f.median_se();
+        bool usable = f.converged && f.b > 0;
+        json r = s.parameters;
+        r["case.id"] = i+1;
+        r["parameter"] = id50.parameter;
+        r["replicates"] = std::accumulate(s.n.begin(), s.n.end(), 0.0);
+        r["log10.id50"] = usable ? json(x50) : json();
+        r["log10.id50.se"] = usable ? json(f.median_se()) : json();
+        r["id50"] = usable ? json(std::pow(10.0, x50)) : json();
+        r["id50.lower"] = usable ? json(std::pow(10.0, x50 - half)) : json();
+        r["id50.upper"] = usable ? json(std::pow(10.0, x50 + half)) : json();
+        r["slope"] = f.b;
+        r["in.range"] = usable && x50 >= lo && x50 <= hi;
+        r["converged"] = usable && 2*half <= id50.ci_width;
+        LOG("Combination " << i+1 << " " << s.parameters.dump() << ": " << r.dump());
+        if (id50.output) id50.output->append(r.dump() + "\n");
+    };
+
+    /* Queue a round of replicates at the given log10 doses; called under the runner's lock */
+    std::function<void(uint32_t, const std::vector<double>&)> submit_round = [&](uint32_t i, const std::vector<double> &xs) {
+        auto &s = searches[i];
+        auto per_dose = std::min<uint32_t>(settings.batch, (replicates - s.submitted)/xs.size());
+        if (per_dose == 0) {
+            report(i, fit(s));
+            return;
+        }
+        for(auto x : xs) {
+            auto j = s.x.size();
+            s.x.push_back(x);
+            s.infected.push_back(0);
+            s.n.push_back(0);
+            auto first = s.submitted;
+            s.submitted += per_dose;
+            s.pending += per_dose;
+
+            /* The model and the shared initial state of the dose are built on the pool without the lock */
+            runner.submit_task([&, i, j, x, first, per_dose]() {
+                auto input = make_input(i, x);
+                auto model = make_model(*input);
+                std::shared_ptr<const BasicSimulator<model_t>> initial;
+                if (settings.shared_setup) {
+                    initial = shared_setup(*input, *model, i+1, settings);
+                }
+                std::lock_guard<std::mutex> lock(runner.get_mutex());
+                for(auto r = first; r<first + per_dose; r++) {
+                    runner.submit(input, model, initial, i+1, r, costs[i], [&, i, j](const ReplicateResult &result) {
+                        auto &c = searches[i];
+                        c.pending--;
+                        if (result.completed) {
+                            c.infected[j] += result.infected;
+                            c.n[j]++;
+                        } else {
+                            c.interrupted = true;
+                        }
+                        if (c.pending > 0) return;
+
+                        /* end of a round */
+                        auto f = fit(c);
+                        bool narrow = f.converged && f.b > 0 && 2*z*f.median_se() <= id50.ci_width;
+                        if (narrow || c.interrupted || replicates - c.submitted < 3) {
+                            report(i, f);
+                            return;
+                        }
+                        std::vector<double> next;
+                        if (f.converged && f.b > 0) {
+                            double d = std::log(3.0)/f.b; // from 25% to 50% infection
+                            for(auto x : { f.median() - d, f.median(), f.median() + d }) {
+                                next.push_back(std::max(lo, std::min(hi, x)));
+                            }
+                        } else {
+                            next.push_back(lo);
+                            next.push_back((lo + hi)/2);
+                            next.push_back(hi);
+                        }
+                        submit_round(i, next);
+                    });
+                }
+            }, costs[i]);
+        }
+    };
+    {
+        std::lock_guard<std::mutex> lock(runner.get_mutex());
+        for(auto i : longest_first(costs)) {
+            std::vector<double> xs;
+            for(auto k = 0u; k<id50.initial_doses; k++) {
+                xs.push_back(id50.initial_doses > 1 ? lo + (hi - lo)*k/(id50.initial_doses - 1) : (lo + hi)/2);
+            }
+            submit_round(i, xs);
+        }
+    }
+    runner.wait();
+    runner.log_totals();
+}
+
+struct SplittingSweep {
+    SplittingSettings splitting; // progress coordinate, levels, outcome and trajectories per stage
+    std::string entity_name; // of the progress coordinate
+    uint32_t repetitions = 10; // independent estimates per case, for the standard error
+    std::shared_ptr<SharedOutput> output; // one JSON line per case, if set
+};
+
+/*
+ * Rare infection probabilities by multilevel splitting (toxin --cases cases.json --split-levels L1,L2,...).
+ *
+ * The trajectories of a case are split when the count of the progress entity (bacteria) first
+ * reaches each level, and weighted so that the estimate stays unbiased (see
+ * multilevel_splitting). Each case gets the given number of independent estimates, whose mean
+ * and standard error are reported together with the number of plain replicates that would
+ * give the same standard error. Trajectory k of stage j of repetition r uses the RNG block
+ * (j, k) of the stream (case, r); the trajectories of a stage run on the thread pool.
+ */
+void run_splitting(const json &model_input, const json &spec, unsigned int threads, const SweepSettings &settings, const SplittingSweep &split) {
+    auto cases = expand_cases(spec);
+    auto &levels = split.splitting.levels;
+    LOG("Multilevel splitting of " << cases.size() << " cases at " << split.entity_name << " counts " << join(",", levels) << " with " 
+        << split.splitting.trajectories << " trajectories per stage and " << split.repetitions << " repetitions, master seed " << settings.master_seed);
+    auto z = normal_quantile(settings.confidence);
+
+    using model_t = decltype(get_model(model_input));
+    using simulator_t = BasicSimulator<model_t>;
+    ThreadPool pool(threads);
+    LOG("Running on " << pool.size() << " threads");
+    for(auto i = 0u; i<cases.size() && !SIG_INT_RECEIVED; i++) {
+        uint32_t case_id = i+1;
+        auto input = case_input(model_input, cases[i], case_id);
+        auto model = get_model(input);
+        model.done();
+        std::shared_ptr<const simulator_t> initial;
+        if (settings.shared_setup) {
+            initial = shared_setup(input, model, case_id, settings);
+        }
+
+        std::vector<double> estimates, fractions(levels.size(), 0);
+        uint64_t segments = 0;
+        for(auto rep = 0u; rep<split.repetitions; rep++) {
+            auto start = [&, rep](uint32_t k) {
+                auto s = std::make_shared<simulator_t>(settings.U, model.clone());
+                if (initial) {
+                    s->copy_state_from(*initial);
+                    s->set_stream(settings.master_seed, StreamId(case_id, rep, 0, k));
+                } else {
+                    s->add_halting_flag(&SIG_INT_RECEIVED);
+                    s->set_stream(settings.master_seed, StreamId(case_id, rep, 0, k));
+                    setup_state(*s, input);
+                }
+                return s;
+            };
+            auto reseed = [&, rep](simulator_t &s, uint32_t stage, uint32_t k) {
+                s.set_stream(settings.master_seed, StreamId(case_id, rep, stage, k));
+            };
+            auto result = multilevel_splitting<model_t>(split.splitting, start, reseed, pool);
+            if (SIG_INT_RECEIVED) { // the interrupted trajectories would bias the estimate
+                log_interrupt();
+                break;
+            }
+
+            estimates.push_back(result.probability);
+            for(auto j = 0u; j<levels.size(); j++) {
+                fractions[j] += double(result.crossed[j]) / split.splitting.trajectories;
+            }
+            segments += result.segments;
+            LOG("Case " << case_id << ", repetition " << rep << ": probability " << result.probability << ", " 
+                << result.succeeded << " successful trajectories of " << result.segments);
+        }
+        if (estimates.empty()) break;
+
+        auto n = estimates.size();
+        double mean = std::accumulate(estimates.begin(), estimates.end(), 0.0) / n;
+        double ss = 0;
+        for(auto e : estimates) ss += (e - mean)*(e - mean);
+        double se = n > 1 ? std::sqrt(ss/(n - 1)/n) : 0;
+        for(auto &f : fractions) f /= n;
+
+        json r = cases[i];
+        r["case.id"] = case_id;
+        r["entity"] = split.entity_name;
+        r["levels"] = levels;
+        r["trajectories"] = split.splitting.trajectories;
+        r["repetitions"] = n;
+        r["probability"] = mean;
+        r["probability.se"] = n > 1 ? json(se) : json();
+        r["probability.lower"] = n > 1 ? json(std::max(0.0, mean - z*se)) : json();
+        r["probability.upper"] = n > 1 ? json(std::min(1.0, mean + z*se)) : json();
+        r["estimates"] = estimates;
+        r["level.fractions"] = fractions;
+        r["segments"] = segments;
+        r["equivalent.replicates"] = se > 0 ? json(mean*(1 - mean)/(se*se)) : json();
+        LOG("Case " << case_id << " " << cases[i].dump() << ": " << r.dump());
+        if (split.output) split.output->append(r.dump() + "\n");
+    }
+}
+
+#endif